@@ -0,0 +1,426 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "components/transform.h"
+#include "entity.h"
+
+// Dynamic bounding volume tree over Transform::rect(), answers "what
+// overlaps this rect" and "which pairs overlap in here" without looking at
+// every entity.
+//
+// Same bookkeeping as SpatialGrid: adds and removes come from listening to
+// the Transform pool, writes are read from the pool's write log when sync()
+// runs. Leaves hold the rect grown by MARGIN, so a card that moves a little
+// only updates its rect and the tree is only touched once it leaves that
+// box. Inserts pick the cheapest sibling by perimeter and rotate on the way
+// back up to keep the tree balanced.
+//
+// Every node also keeps the highest z_index below it, pick() uses that to
+// find the topmost rect under a point without visiting the ones it covers.
+//
+// Overlap is strict, rects that only share an edge dont overlap.
+struct AABBTree : PoolListener {
+  static constexpr float MARGIN = 8.f;
+
+  [[nodiscard]] static AABBTree &get() {
+    static AABBTree tree;
+    return tree;
+  }
+
+  AABBTree(const AABBTree &) = delete;
+  AABBTree &operator=(const AABBTree &) = delete;
+
+  ~AABBTree() {
+    if (BaseComponentPool *pool = transforms())
+      pool->unlisten(this);
+  }
+
+  // Picks up every Transform written since the last sync
+  void sync() {
+    ComponentPool<Transform> &pool = ComponentStorage::get<Transform>();
+    for (int slot : pool.take_written(write_log)) {
+      if (slot >= static_cast<int>(leaves.size()) || leaves[slot] == NONE ||
+          !pool.contains(slot))
+        continue;
+      const int leaf = leaves[slot];
+      const Transform &transform = std::as_const(pool).get(slot);
+      const AABB rect = aabb_of(transform.rect());
+      const bool z_changed = nodes[leaf].max_z != transform.z_index;
+      nodes[leaf].rect = rect;
+      nodes[leaf].max_z = transform.z_index;
+      if (encloses(nodes[leaf].box, rect)) {
+        if (z_changed)
+          refit_upwards(nodes[leaf].parent);
+        continue;
+      }
+      remove_leaf(leaf);
+      nodes[leaf].box = fatten(rect);
+      insert_leaf(leaf);
+    }
+  }
+
+  // Calls fn(Entity&) for every entity whose rect overlaps `rect`
+  template <typename Fn>
+  void for_each_overlapping(const raylib::Rectangle &rect, Fn &&fn) const {
+    const AABB area = aabb_of(rect);
+    visit(area, [&](int leaf) {
+      if (overlaps(nodes[leaf].rect, area))
+        fn(*nodes[leaf].entity);
+    });
+  }
+
+  // Calls fn(Entity&, Entity&) once for every two entities whose rects
+  // overlap each other and both overlap `region`
+  template <typename Fn>
+  void for_each_pair(const raylib::Rectangle &region, Fn &&fn) const {
+    const AABB area = aabb_of(region);
+    visit(area, [&](int a) {
+      const AABB &rect = nodes[a].rect;
+      if (!overlaps(rect, area))
+        return;
+      visit(rect, [&](int b) {
+        // each pair once
+        if (b <= a || !overlaps(nodes[b].rect, area) ||
+            !overlaps(nodes[b].rect, rect))
+          return;
+        fn(*nodes[a].entity, *nodes[b].entity);
+      });
+    });
+  }
+
+  // The entity drawn on top among the ones whose rect contains `point`
+  // (edges included) and that pass `filter`: highest z_index, then the one
+  // furthest down the entity list on equal z, same as the render order.
+  // Subtrees whose max z is below the best so far are skipped and the higher
+  // child is tried first, so a tall stack costs about one walk down the tree
+  // plus one check per card sharing the top z
+  template <typename Fn>
+  [[nodiscard]] OptEntity pick(vec2 point, Fn &&filter) const {
+    if (root == NONE)
+      return {};
+    int best = NONE;
+    std::vector<int> stack = {root};
+    while (!stack.empty()) {
+      const int index = stack.back();
+      stack.pop_back();
+      const Node &node = nodes[index];
+      if (best != NONE && node.max_z < nodes[best].max_z)
+        continue;
+      if (!contains(node.box, point))
+        continue;
+      if (node.is_leaf()) {
+        if (contains(node.rect, point) &&
+            (best == NONE || drawn_above(index, best)) &&
+            filter(std::as_const(*node.entity)))
+          best = index;
+        continue;
+      }
+      // the higher child goes on last so it is popped first
+      const bool left_first =
+          nodes[node.left].max_z >= nodes[node.right].max_z;
+      stack.push_back(left_first ? node.right : node.left);
+      stack.push_back(left_first ? node.left : node.right);
+    }
+    if (best == NONE)
+      return {};
+    return *nodes[best].entity;
+  }
+
+  [[nodiscard]] size_t size() const { return num_leaves; }
+
+  virtual void on_added(Entity &entity) override {
+    const int slot = entity.handle.index;
+    if (slot >= static_cast<int>(leaves.size()))
+      leaves.resize(slot + 1, NONE);
+    const int leaf = allocate();
+    const Transform &transform = std::as_const(entity).get<Transform>();
+    const AABB rect = aabb_of(transform.rect());
+    nodes[leaf].entity = &entity;
+    nodes[leaf].rect = rect;
+    nodes[leaf].max_z = transform.z_index;
+    nodes[leaf].box = fatten(rect);
+    insert_leaf(leaf);
+    leaves[slot] = leaf;
+    num_leaves++;
+  }
+
+  virtual void on_removed(Entity &entity) override {
+    const int slot = entity.handle.index;
+    if (slot >= static_cast<int>(leaves.size()) || leaves[slot] == NONE)
+      return;
+    remove_leaf(leaves[slot]);
+    release(leaves[slot]);
+    leaves[slot] = NONE;
+    num_leaves--;
+  }
+
+private:
+  static constexpr int NONE = -1;
+
+  struct AABB {
+    vec2 min;
+    vec2 max;
+  };
+
+  struct Node {
+    // fat box for leaves, union of the children otherwise
+    AABB box;
+    // leaves only, the entity's actual rect
+    AABB rect;
+    // z_index for leaves, highest of the children otherwise
+    float max_z = 0;
+    Entity *entity = nullptr;
+    // next free node while on the free list
+    int parent = NONE;
+    int left = NONE;
+    int right = NONE;
+    // 0 for leaves, -1 while free
+    int height = 0;
+
+    [[nodiscard]] bool is_leaf() const { return left == NONE; }
+  };
+
+  std::vector<Node> nodes;
+  int root = NONE;
+  int free_list = NONE;
+  size_t num_leaves = 0;
+  // by entity slot
+  std::vector<int> leaves;
+  size_t write_log = 0;
+
+  AABBTree() {
+    ComponentPool<Transform> &pool = ComponentStorage::get<Transform>();
+    // anything written before now is covered by the initial fill
+    write_log = pool.track_writes();
+    for (Entity *owner : pool.owners)
+      on_added(*owner);
+    pool.listen(this);
+  }
+
+  [[nodiscard]] static BaseComponentPool *transforms() {
+    return ComponentStorage::pools[components::get_type_id<Transform>()];
+  }
+
+  [[nodiscard]] static AABB aabb_of(const raylib::Rectangle &rect) {
+    const vec2 a = {rect.x, rect.y};
+    const vec2 b = {rect.x + rect.width, rect.y + rect.height};
+    return {{std::min(a.x, b.x), std::min(a.y, b.y)},
+            {std::max(a.x, b.x), std::max(a.y, b.y)}};
+  }
+
+  [[nodiscard]] static AABB fatten(const AABB &box) {
+    return {{box.min.x - MARGIN, box.min.y - MARGIN},
+            {box.max.x + MARGIN, box.max.y + MARGIN}};
+  }
+
+  [[nodiscard]] static AABB merge(const AABB &a, const AABB &b) {
+    return {{std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y)},
+            {std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y)}};
+  }
+
+  [[nodiscard]] static float perimeter(const AABB &box) {
+    return 2.f * ((box.max.x - box.min.x) + (box.max.y - box.min.y));
+  }
+
+  [[nodiscard]] static bool overlaps(const AABB &a, const AABB &b) {
+    return a.min.x < b.max.x && b.min.x < a.max.x && a.min.y < b.max.y &&
+           b.min.y < a.max.y;
+  }
+
+  [[nodiscard]] static bool contains(const AABB &box, vec2 point) {
+    return box.min.x <= point.x && point.x <= box.max.x &&
+           box.min.y <= point.y && point.y <= box.max.y;
+  }
+
+  // Render order between two leaves, a leaf's max_z is its own z_index
+  [[nodiscard]] bool drawn_above(int a, int b) const {
+    if (nodes[a].max_z != nodes[b].max_z)
+      return nodes[a].max_z > nodes[b].max_z;
+    return nodes[a].entity->list_index > nodes[b].entity->list_index;
+  }
+
+  [[nodiscard]] static bool encloses(const AABB &outer, const AABB &inner) {
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y &&
+           inner.max.x <= outer.max.x && inner.max.y <= outer.max.y;
+  }
+
+  // Calls fn(leaf) for every leaf whose fat box overlaps `area`
+  template <typename Fn> void visit(const AABB &area, Fn &&fn) const {
+    if (root == NONE)
+      return;
+    std::vector<int> stack = {root};
+    while (!stack.empty()) {
+      const int index = stack.back();
+      stack.pop_back();
+      const Node &node = nodes[index];
+      if (!overlaps(node.box, area))
+        continue;
+      if (node.is_leaf()) {
+        fn(index);
+        continue;
+      }
+      stack.push_back(node.left);
+      stack.push_back(node.right);
+    }
+  }
+
+  [[nodiscard]] int allocate() {
+    if (free_list == NONE) {
+      nodes.emplace_back();
+      return static_cast<int>(nodes.size()) - 1;
+    }
+    const int index = free_list;
+    free_list = nodes[index].parent;
+    nodes[index] = Node{};
+    return index;
+  }
+
+  void release(int index) {
+    nodes[index] = Node{};
+    nodes[index].parent = free_list;
+    nodes[index].height = -1;
+    free_list = index;
+  }
+
+  void replace_child(int parent, int old_child, int new_child) {
+    if (parent == NONE) {
+      root = new_child;
+      return;
+    }
+    if (nodes[parent].left == old_child)
+      nodes[parent].left = new_child;
+    else
+      nodes[parent].right = new_child;
+  }
+
+  void insert_leaf(int leaf) {
+    if (root == NONE) {
+      root = leaf;
+      nodes[leaf].parent = NONE;
+      return;
+    }
+
+    // walk down towards the sibling that grows the tree's perimeter least
+    const AABB box = nodes[leaf].box;
+    int index = root;
+    while (!nodes[index].is_leaf()) {
+      const Node &node = nodes[index];
+      const float combined = perimeter(merge(node.box, box));
+      // pairing with this node makes a new parent of that size
+      const float here = 2.f * combined;
+      // going further down grows this node either way
+      const float inherited = 2.f * (combined - perimeter(node.box));
+      const auto descend = [&](int child) {
+        const Node &c = nodes[child];
+        float grown = perimeter(merge(c.box, box));
+        if (!c.is_leaf())
+          grown -= perimeter(c.box);
+        return grown + inherited;
+      };
+      const float left = descend(node.left);
+      const float right = descend(node.right);
+      if (here < left && here < right)
+        break;
+      index = left < right ? node.left : node.right;
+    }
+
+    const int sibling = index;
+    const int old_parent = nodes[sibling].parent;
+    const int parent = allocate();
+    Node &p = nodes[parent];
+    p.parent = old_parent;
+    p.box = merge(box, nodes[sibling].box);
+    p.max_z = std::max(nodes[leaf].max_z, nodes[sibling].max_z);
+    p.height = nodes[sibling].height + 1;
+    p.left = sibling;
+    p.right = leaf;
+    nodes[sibling].parent = parent;
+    nodes[leaf].parent = parent;
+    replace_child(old_parent, sibling, parent);
+
+    refit_upwards(parent);
+  }
+
+  void remove_leaf(int leaf) {
+    if (leaf == root) {
+      root = NONE;
+      return;
+    }
+    const int parent = nodes[leaf].parent;
+    const int grandparent = nodes[parent].parent;
+    const int sibling =
+        nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+    replace_child(grandparent, parent, sibling);
+    nodes[sibling].parent = grandparent;
+    release(parent);
+    nodes[leaf].parent = NONE;
+    refit_upwards(grandparent);
+  }
+
+  void refit_upwards(int index) {
+    while (index != NONE) {
+      index = balance(index);
+      Node &node = nodes[index];
+      const Node &left = nodes[node.left];
+      const Node &right = nodes[node.right];
+      node.height = 1 + std::max(left.height, right.height);
+      node.box = merge(left.box, right.box);
+      node.max_z = std::max(left.max_z, right.max_z);
+      index = node.parent;
+    }
+  }
+
+  // If one child of `a` is more than one level taller than the other it is
+  // rotated up into a's place. Returns whatever now sits there
+  [[nodiscard]] int balance(int a) {
+    Node &A = nodes[a];
+    if (A.is_leaf() || A.height < 2)
+      return a;
+
+    const int b = A.left;
+    const int c = A.right;
+    const int diff = nodes[c].height - nodes[b].height;
+    if (diff > 1)
+      return rotate_up(a, c, b, /* taller_is_right */ true);
+    if (diff < -1)
+      return rotate_up(a, b, c, /* taller_is_right */ false);
+    return a;
+  }
+
+  // Moves `up` (the taller child of `a`) into a's place, `a` keeps `other`
+  // and takes the shorter of up's children
+  [[nodiscard]] int rotate_up(int a, int up, int other, bool taller_is_right) {
+    Node &A = nodes[a];
+    Node &U = nodes[up];
+    const int f = U.left;
+    const int g = U.right;
+
+    U.left = a;
+    U.parent = A.parent;
+    A.parent = up;
+    replace_child(U.parent, a, up);
+
+    const bool f_taller = nodes[f].height > nodes[g].height;
+    const int keep = f_taller ? f : g;
+    const int give = f_taller ? g : f;
+
+    U.right = keep;
+    if (taller_is_right)
+      A.right = give;
+    else
+      A.left = give;
+    nodes[give].parent = a;
+
+    A.box = merge(nodes[other].box, nodes[give].box);
+    A.height = 1 + std::max(nodes[other].height, nodes[give].height);
+    A.max_z = std::max(nodes[other].max_z, nodes[give].max_z);
+    U.box = merge(A.box, nodes[keep].box);
+    U.height = 1 + std::max(A.height, nodes[keep].height);
+    U.max_z = std::max(A.max_z, nodes[keep].max_z);
+    return up;
+  }
+};
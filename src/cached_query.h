@@ -0,0 +1,135 @@
+#pragma once
+
+#include "static_query.h"
+
+// A StaticQuery that keeps its result between calls, for the ones that run
+// every frame like "all empty slots" or "all cards".
+//
+// It registers with the pools of its required components, so entities that
+// gain or lose one of them are added / dropped as it happens. The result is
+// only rebuilt from scratch when a component the filters read was written
+// (or, for queries without a required component, when entities came or
+// went). On a quiet frame get() just hands back the vector.
+//
+// The built in filters list what they read, anything a whereLambda looks at
+// has to be passed in as `also_watch`:
+//
+//   CachedQuery empty_slots(
+//       StaticQuery<>().whereHasComponent<IsSlot>().whereLambda(is_empty),
+//       components::mask<IsSlot>());
+//
+// An entity's type is treated as fixed once it has its components.
+template <typename... Ps> struct CachedQuery : PoolListener {
+  explicit CachedQuery(StaticQuery<Ps...> q, ComponentBitSet also_watch = {})
+      : query(std::move(q)), required(query.required()),
+        watched(also_watch | query.reads()) {
+    VALIDATE(query.from_world, "cached queries only run over the world");
+    VALIDATE(query.limit == std::numeric_limits<size_t>::max(),
+             "cached queries keep every match, call take() on the result");
+    listen_to_new_pools();
+  }
+
+  ~CachedQuery() {
+    for (ComponentID cid = 0; cid < max_num_components; cid++) {
+      if (listening[cid] && ComponentStorage::pools[cid])
+        ComponentStorage::pools[cid]->unlisten(this);
+    }
+  }
+
+  // Registered by address with the pools
+  CachedQuery(const CachedQuery &) = delete;
+  CachedQuery &operator=(const CachedQuery &) = delete;
+
+  [[nodiscard]] const Entities &get() {
+    listen_to_new_pools();
+    if (dirty || seen_version != current_version())
+      rebuild();
+    return results;
+  }
+
+  [[nodiscard]] size_t size() { return get().size(); }
+  [[nodiscard]] bool empty() { return get().empty(); }
+
+  // Forces the next get() to rebuild
+  void invalidate() { dirty = true; }
+
+  virtual void on_added(Entity &entity) override {
+    if (dirty || contains(entity))
+      return;
+    if ((entity.componentSet & required) != required)
+      return;
+    if (query.matches(entity))
+      insert(entity);
+  }
+
+  virtual void on_removed(Entity &entity) override {
+    if (dirty || !contains(entity))
+      return;
+    int index = positions[entity.handle.index];
+    Entity *last = results.back();
+    results[index] = last;
+    positions[last->handle.index] = index;
+    results.pop_back();
+    positions[entity.handle.index] = -1;
+  }
+
+private:
+  StaticQuery<Ps...> query;
+  ComponentBitSet required;
+  ComponentBitSet watched;
+
+  Entities results;
+  // entity slot -> index in results, -1 when it is not in there
+  std::vector<int> positions;
+  // required pools this is registered with
+  ComponentBitSet listening;
+  uint64_t seen_version = 0;
+  bool dirty = true;
+
+  // Pools are globals, one can still be missing when a query is made during
+  // static init. It gets listened to once it exists, and since rows could
+  // have been added before that the next get() rebuilds
+  void listen_to_new_pools() {
+    if (listening == required)
+      return;
+    for (ComponentID cid = 0; cid < max_num_components; cid++) {
+      if (!required[cid] || listening[cid] || !ComponentStorage::pools[cid])
+        continue;
+      ComponentStorage::pools[cid]->listen(this);
+      listening[cid] = true;
+      dirty = true;
+    }
+  }
+
+  // Versions only ever go up, so the sum changes whenever any of them does
+  [[nodiscard]] uint64_t current_version() const {
+    uint64_t sum = required.none() ? EntityHelper::structure_version() : 0;
+    for (ComponentID cid = 0; cid < max_num_components; cid++) {
+      if (watched[cid] && ComponentStorage::pools[cid])
+        sum += ComponentStorage::pools[cid]->version;
+    }
+    return sum;
+  }
+
+  [[nodiscard]] bool contains(const Entity &entity) const {
+    int slot = entity.handle.index;
+    return slot < static_cast<int>(positions.size()) && positions[slot] != -1;
+  }
+
+  void insert(Entity &entity) {
+    int slot = entity.handle.index;
+    if (slot >= static_cast<int>(positions.size()))
+      positions.resize(slot + 1, -1);
+    positions[slot] = static_cast<int>(results.size());
+    results.push_back(&entity);
+  }
+
+  void rebuild() {
+    // results can point at entities destroyed since, dont touch them
+    std::fill(positions.begin(), positions.end(), -1);
+    results.clear();
+    query.each([this](Entity &entity) { insert(entity); });
+    seen_version = current_version();
+    dirty = false;
+  }
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "entity_helper.h"
+
+// Records structural changes (create / destroy / add / remove component)
+// so they can be applied later at a sync point instead of in the middle of
+// iterating the entity list or a component pool.
+//
+// Each system owns one, SystemManager applies it right after the system
+// runs. Commands are applied grouped by entity (in recorded order per
+// entity) so the pools are touched one entity at a time.
+//
+// Adds and removes are stored as a plain function pointer, add values are
+// copied into a byte arena next to the commands. Only create() callbacks
+// (and adds of components that cant be memcpy'd) go through std::function.
+// All three buffers keep their capacity between frames, so a steady stream
+// of commands stops allocating once warmed up.
+struct CommandBuffer {
+  enum struct Op { Create, Add, Remove, Destroy, Call };
+
+  void create(const std::function<void(Entity &)> &init = {}) {
+    uint32_t index = NONE;
+    if (init) {
+      index = static_cast<uint32_t>(callbacks.size());
+      callbacks.push_back(init);
+    }
+    commands.push_back({Op::Create, EntityHandle::null(), nullptr, index});
+  }
+
+  void destroy(EntityHandle target) {
+    commands.push_back({Op::Destroy, target, nullptr, NONE});
+  }
+
+  template <typename T> void add(EntityHandle target, T value = {}) {
+    if constexpr (std::is_trivially_copyable_v<T>) {
+      // keep each value aligned for its type inside the arena
+      const size_t offset =
+          (arena.size() + alignof(T) - 1) / alignof(T) * alignof(T);
+      arena.resize(offset + sizeof(T));
+      std::memcpy(arena.data() + offset, &value, sizeof(T));
+      commands.push_back(
+          {Op::Add, target, &add_from<T>, static_cast<uint32_t>(offset)});
+    } else {
+      const auto index = static_cast<uint32_t>(callbacks.size());
+      callbacks.push_back([value = std::move(value)](Entity &entity) {
+        entity.addComponent<T>(value);
+      });
+      commands.push_back({Op::Call, target, nullptr, index});
+    }
+  }
+
+  template <typename T> void remove(EntityHandle target) {
+    commands.push_back({Op::Remove, target, &remove_from<T>, NONE});
+  }
+
+  [[nodiscard]] bool empty() const { return commands.empty(); }
+  [[nodiscard]] size_t size() const { return commands.size(); }
+
+  // Commands recorded while applying (say by a create() callback) go into a
+  // fresh batch that is applied right after this one
+  void apply() {
+    bool any_destroyed = false;
+    while (!commands.empty()) {
+      std::vector<Command> batch = std::exchange(commands, {});
+      std::vector<std::byte> values = std::exchange(arena, {});
+      std::vector<std::function<void(Entity &)>> inits =
+          std::exchange(callbacks, {});
+      any_destroyed |= apply_batch(batch, values, inits);
+
+      // hand the capacity back unless the batch recorded more
+      if (commands.empty()) {
+        batch.clear();
+        values.clear();
+        inits.clear();
+        commands.swap(batch);
+        arena.swap(values);
+        callbacks.swap(inits);
+      }
+    }
+
+    // destroy everything this batch marked in one go
+    if (any_destroyed)
+      EntityHelper::cleanup();
+  }
+
+private:
+  static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+  struct Command {
+    Op op;
+    EntityHandle target;
+    // Add: copies the value at `data` out of the arena, Remove: ignores it
+    void (*run)(Entity &, const std::byte *);
+    // Add: arena offset, Create / Call: index into callbacks
+    uint32_t data;
+  };
+
+  std::vector<Command> commands;
+  std::vector<std::byte> arena;
+  std::vector<std::function<void(Entity &)>> callbacks;
+
+  template <typename T>
+  static void add_from(Entity &entity, const std::byte *data) {
+    alignas(T) std::byte value[sizeof(T)];
+    std::memcpy(value, data, sizeof(T));
+    entity.addComponent<T>(*std::launder(reinterpret_cast<T *>(value)));
+  }
+
+  template <typename T>
+  static void remove_from(Entity &entity, const std::byte *) {
+    entity.removeComponent<T>();
+  }
+
+  // Returns whether anything was marked for cleanup
+  static bool
+  apply_batch(std::vector<Command> &batch, const std::vector<std::byte> &values,
+              const std::vector<std::function<void(Entity &)>> &inits) {
+    // creates have a null target so they sort first, everything else is
+    // grouped by slot but keeps the order it was recorded in
+    std::stable_sort(batch.begin(), batch.end(),
+                     [](const Command &a, const Command &b) {
+                       return a.target.index < b.target.index;
+                     });
+
+    size_t num_created = 0;
+    for (const Command &command : batch) {
+      if (command.op == Op::Create)
+        num_created++;
+    }
+    if (num_created > 0)
+      EntityHelper::reserveEntities(num_created);
+
+    bool any_destroyed = false;
+    for (const Command &command : batch) {
+      if (command.op == Op::Create) {
+        Entity &entity = EntityHelper::createEntity();
+        if (command.data != NONE)
+          inits[command.data](entity);
+        continue;
+      }
+
+      // target died (or was already destroyed by this buffer)
+      OptEntity entity = EntityHelper::getEntityForHandle(command.target);
+      if (!entity || entity->cleanup)
+        continue;
+
+      switch (command.op) {
+      case Op::Destroy:
+        EntityHelper::markForCleanup(entity.asE());
+        any_destroyed = true;
+        break;
+      case Op::Call:
+        inits[command.data](entity.asE());
+        break;
+      case Op::Add:
+        command.run(entity.asE(), values.data() + command.data);
+        break;
+      case Op::Remove:
+        command.run(entity.asE(), nullptr);
+        break;
+      case Op::Create:
+        break;
+      }
+    }
+    return any_destroyed;
+  }
+};
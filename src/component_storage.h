@@ -0,0 +1,356 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "components/base_component.h"
+
+struct Entity;
+
+// World clock for change tracking, SystemManager advances it once per update.
+// Every row remembers the tick it was added at and last changed at, so a
+// system can ask "what moved since I last ran" instead of looking at
+// everything.
+using Tick = uint32_t;
+namespace components {
+inline Tick current_tick = 1;
+} // namespace components
+
+// Implemented by things that keep derived state about which entities have a
+// component (see CachedQuery). Told right after a row is added and right
+// before one is removed.
+struct PoolListener {
+  virtual ~PoolListener() {}
+  virtual void on_added(Entity &) = 0;
+  virtual void on_removed(Entity &) = 0;
+};
+
+// Components no longer live in their own heap allocation, instead every
+// component type gets one contiguous column and entities store the row they
+// own. Walking every Transform is then a linear scan over memory instead of a
+// pointer chase per entity.
+//
+// Each pool is a sparse set: `sparse` maps an entity slot (the index part of
+// its EntityHandle) to its row, and the dense arrays (`owners`, `slots` and
+// the typed column) stay packed. Removing a component moves the last row into
+// the hole, so references returned from get<T>() are only valid until the
+// next add/remove of that component type.
+//
+// Lifecycle hooks are plain function pointers owned by the pool, which keeps
+// the components themselves free of any vtable.
+//
+// Getting a row through get_mut() (which is what Entity::get_mut<T>() does)
+// stamps it as changed this tick, plain get() does not.
+struct BaseComponentPool {
+  static constexpr int PAGE_SIZE = 1024;
+  using Page = std::array<int, PAGE_SIZE>;
+  using Hook = void (*)(Entity &);
+
+  std::vector<std::unique_ptr<Page>> sparse;
+  std::vector<Entity *> owners;
+  std::vector<int> slots;
+  std::vector<Tick> added_at;
+  std::vector<Tick> changed_at;
+
+  // Newest tick any row was changed / added / removed at
+  Tick last_changed = 0;
+  Tick last_added = 0;
+  Tick last_removed = 0;
+
+  // Bumped on every add, remove and write. Unlike the ticks it moves within
+  // a frame, so comparing two reads tells you for sure nothing happened
+  uint64_t version = 0;
+
+  // Run after a component is added / before it is removed, the component is
+  // still readable from inside both
+  std::vector<Hook> on_add;
+  std::vector<Hook> on_remove;
+  std::vector<PoolListener *> listeners;
+
+  // Slots written since the reader last called take_written(), one log per
+  // reader that asked for it with track_writes() (the spatial indices do for
+  // Transform). Nothing is recorded while there are none
+  struct WriteLog {
+    std::vector<int> written;
+    std::vector<uint8_t> is_written;
+  };
+  std::vector<WriteLog> write_logs;
+
+  virtual ~BaseComponentPool() {}
+
+  [[nodiscard]] size_t size() const { return owners.size(); }
+  [[nodiscard]] bool empty() const { return owners.empty(); }
+
+  [[nodiscard]] int index_of(int slot) const {
+    size_t page = static_cast<size_t>(slot / PAGE_SIZE);
+    if (slot < 0 || page >= sparse.size() || !sparse[page])
+      return -1;
+    return (*sparse[page])[slot % PAGE_SIZE];
+  }
+
+  [[nodiscard]] bool contains(int slot) const { return index_of(slot) != -1; }
+
+  void mark_changed(int slot) {
+    int index = index_of(slot);
+    if (index == -1)
+      return;
+    changed_at[index] = components::current_tick;
+    last_changed = components::current_tick;
+    version++;
+    if (!write_logs.empty())
+      note_write(slot);
+  }
+
+  // Starts a new write log, pass what it returns to take_written()
+  [[nodiscard]] size_t track_writes() {
+    write_logs.emplace_back();
+    return write_logs.size() - 1;
+  }
+
+  // Hands back every slot written since the last call, each one once
+  [[nodiscard]] std::vector<int> take_written(size_t log) {
+    WriteLog &wl = write_logs[log];
+    std::vector<int> out;
+    out.swap(wl.written);
+    for (int slot : out)
+      wl.is_written[slot] = 0;
+    return out;
+  }
+
+  // "since" is exclusive, pass the tick you last looked at
+  [[nodiscard]] bool changed_since(int slot, Tick since) const {
+    int index = index_of(slot);
+    return index != -1 && changed_at[index] > since;
+  }
+  [[nodiscard]] bool added_since(int slot, Tick since) const {
+    int index = index_of(slot);
+    return index != -1 && added_at[index] > since;
+  }
+
+  // Cheap pool wide checks, lets a system skip work entirely on a quiet frame
+  [[nodiscard]] bool any_changed_since(Tick since) const {
+    return last_changed > since;
+  }
+  [[nodiscard]] bool structure_changed_since(Tick since) const {
+    return last_added > since || last_removed > since;
+  }
+
+  void notify_add(Entity &owner) const {
+    for (Hook hook : on_add)
+      hook(owner);
+    for (PoolListener *listener : listeners)
+      listener->on_added(owner);
+  }
+
+  void notify_remove(Entity &owner) const {
+    for (Hook hook : on_remove)
+      hook(owner);
+    for (PoolListener *listener : listeners)
+      listener->on_removed(owner);
+  }
+
+  void listen(PoolListener *listener) { listeners.push_back(listener); }
+  void unlisten(PoolListener *listener) {
+    std::erase(listeners, listener);
+  }
+
+  void detach(Entity &owner, int slot) {
+    notify_remove(owner);
+    remove(slot);
+  }
+
+  // Drops every row at once, much cheaper than removing them one by one
+  void clear() {
+    if (!on_remove.empty() || !listeners.empty()) {
+      for (Entity *owner : owners)
+        notify_remove(*owner);
+    }
+    clear_rows();
+    sparse.clear();
+    owners.clear();
+    slots.clear();
+    added_at.clear();
+    changed_at.clear();
+    last_removed = components::current_tick;
+    version++;
+  }
+
+  void remove(int slot) {
+    int index = index_of(slot);
+    if (index == -1)
+      return;
+    int last = static_cast<int>(size()) - 1;
+    if (index != last) {
+      move_row(last, index);
+      owners[index] = owners[last];
+      slots[index] = slots[last];
+      added_at[index] = added_at[last];
+      changed_at[index] = changed_at[last];
+      set_index(slots[index], index);
+    }
+    pop_row();
+    owners.pop_back();
+    slots.pop_back();
+    added_at.pop_back();
+    changed_at.pop_back();
+    set_index(slot, -1);
+    last_removed = components::current_tick;
+    version++;
+  }
+
+protected:
+  int push_owner(Entity *owner, int slot) {
+    owners.push_back(owner);
+    slots.push_back(slot);
+    added_at.push_back(components::current_tick);
+    changed_at.push_back(components::current_tick);
+    last_added = components::current_tick;
+    last_changed = components::current_tick;
+    version++;
+    int index = static_cast<int>(size()) - 1;
+    set_index(slot, index);
+    return index;
+  }
+
+  void note_write(int slot) {
+    for (WriteLog &wl : write_logs) {
+      if (slot >= static_cast<int>(wl.is_written.size()))
+        wl.is_written.resize(slot + 1, 0);
+      if (wl.is_written[slot])
+        continue;
+      wl.is_written[slot] = 1;
+      wl.written.push_back(slot);
+    }
+  }
+
+  void set_index(int slot, int index) {
+    size_t page = static_cast<size_t>(slot / PAGE_SIZE);
+    if (page >= sparse.size())
+      sparse.resize(page + 1);
+    if (!sparse[page]) {
+      sparse[page] = std::make_unique<Page>();
+      sparse[page]->fill(-1);
+    }
+    (*sparse[page])[slot % PAGE_SIZE] = index;
+  }
+
+  virtual void move_row(int from, int to) = 0;
+  virtual void pop_row() = 0;
+  virtual void clear_rows() = 0;
+};
+
+template <typename T> struct ComponentPool : BaseComponentPool {
+  std::vector<T> data;
+
+  template <typename... TArgs>
+  T &emplace(Entity *owner, int slot, TArgs &&...args) {
+    data.emplace_back(std::forward<TArgs>(args)...);
+    return data[push_owner(owner, slot)];
+  }
+
+  [[nodiscard]] T &get(int slot) { return data[index_of(slot)]; }
+  [[nodiscard]] const T &get(int slot) const { return data[index_of(slot)]; }
+
+  // Same as get() but records that the caller is going to write to it
+  [[nodiscard]] T &get_mut(int slot) {
+    int index = index_of(slot);
+    changed_at[index] = components::current_tick;
+    last_changed = components::current_tick;
+    version++;
+    if (!write_logs.empty())
+      note_write(slot);
+    return data[index];
+  }
+
+  void reserve(size_t amount) {
+    data.reserve(amount);
+    owners.reserve(amount);
+    slots.reserve(amount);
+    added_at.reserve(amount);
+    changed_at.reserve(amount);
+  }
+
+  // Iterates the column in memory order
+  template <typename Fn> void each(Fn &&fn) {
+    for (size_t i = 0; i < data.size(); i++) {
+      fn(*owners[i], data[i]);
+    }
+  }
+
+  ComponentPool();
+  virtual ~ComponentPool();
+
+protected:
+  virtual void move_row(int from, int to) override {
+    if constexpr (std::is_trivially_copyable_v<T>) {
+      std::memcpy(static_cast<void *>(&data[to]), &data[from], sizeof(T));
+    } else {
+      data[to] = std::move(data[from]);
+    }
+  }
+  virtual void pop_row() override { data.pop_back(); }
+  virtual void clear_rows() override { data.clear(); }
+};
+
+struct ComponentStorage {
+  // Pools register themselves here on construction so that an entity can
+  // drop all of its components knowing only their ids
+  inline static std::array<BaseComponentPool *, max_num_components> pools{};
+
+  template <typename T> [[nodiscard]] static ComponentPool<T> &get();
+
+  static void detach(ComponentID cid, Entity &owner, int slot) {
+    if (pools[cid])
+      pools[cid]->detach(owner, slot);
+  }
+
+  [[nodiscard]] static Tick tick() { return components::current_tick; }
+  static void advance_tick() { components::current_tick++; }
+
+  static void clear_all() {
+    for (BaseComponentPool *pool : pools) {
+      if (pool)
+        pool->clear();
+    }
+  }
+
+  // Returns the pool with the fewest rows among the given component ids,
+  // this is the one a view / query should walk. nullptr means at least one of
+  // them was never added so nothing can match
+  [[nodiscard]] static const BaseComponentPool *
+  smallest(const ComponentBitSet &cids) {
+    const BaseComponentPool *best = nullptr;
+    for (ComponentID cid = 0; cid < max_num_components; cid++) {
+      if (!cids[cid])
+        continue;
+      const BaseComponentPool *pool = pools[cid];
+      if (!pool)
+        return nullptr;
+      if (!best || pool->size() < best->size())
+        best = pool;
+    }
+    return best;
+  }
+};
+
+namespace components {
+template <typename T> inline ComponentPool<T> pool;
+} // namespace components
+
+template <typename T> ComponentPool<T>::ComponentPool() {
+  ComponentStorage::pools[components::get_type_id<T>()] = this;
+}
+
+// Pools and the entity pool are both torn down during static destruction in
+// no particular order, so entities outliving their pools must skip them
+template <typename T> ComponentPool<T>::~ComponentPool() {
+  ComponentStorage::pools[components::get_type_id<T>()] = nullptr;
+}
+
+template <typename T> ComponentPool<T> &ComponentStorage::get() {
+  return components::pool<T>;
+}
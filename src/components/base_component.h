@@ -5,42 +5,72 @@
 #include <bitset>
 #include <map>
 #include <memory>
+#include <type_traits>
+#include <vector>
 
 struct Entity;
-using Entities = std::vector<std::shared_ptr<Entity>>;
+using Entities = std::vector<Entity *>;
 
 struct BaseComponent;
 constexpr int max_num_components = 64;
 using ComponentID = int;
+using ComponentBitSet = std::bitset<max_num_components>;
+
+// Every component type has to be listed here, its position is its id.
+//
+// Ids are used in save files and replication so this list is APPEND ONLY,
+// never reorder or remove an entry.
+struct Transform;
+struct RenderTags;
+struct IsDraggable;
+struct SnapsToSlot;
+struct IsSlot;
+struct IsSolid;
 
 namespace components {
+template <typename... Ts> struct TypeList {
+  static constexpr size_t size = sizeof...(Ts);
+};
+
+using Registry = TypeList<Transform,   //
+                          RenderTags,  //
+                          IsDraggable, //
+                          SnapsToSlot, //
+                          IsSlot,      //
+                          IsSolid      //
+                          >;
+
+static_assert(Registry::size <= max_num_components,
+              "Too many components, bump max_num_components");
+
 namespace internal {
-inline ComponentID get_unique_id() noexcept {
-  static ComponentID lastID{0};
-  return lastID++;
+template <typename T, typename... Ts>
+constexpr ComponentID index_in(TypeList<Ts...>) {
+  ComponentID index = 0;
+  bool found = false;
+  ((found = found || std::is_same_v<T, Ts>, index += found ? 0 : 1), ...);
+  return found ? index : -1;
 }
-
 } // namespace internal
 
-template <typename T> inline ComponentID get_type_id() noexcept {
-  static_assert(std::is_base_of<BaseComponent, T>::value,
-                "T must inherit from BaseComponent");
-  static ComponentID typeID{internal::get_unique_id()};
-  return typeID;
+template <typename T> constexpr ComponentID get_type_id() noexcept {
+  constexpr ComponentID id = internal::index_in<T>(Registry{});
+  static_assert(id != -1, "Component has to be added to components::Registry");
+  return id;
 }
-} // namespace components
-
-struct BaseComponent {
-  Entity *parent = nullptr;
-
-  BaseComponent() {}
-  BaseComponent(BaseComponent &&) = default;
 
-  void attach_parent(Entity *p) {
-    parent = p;
-    onAttach();
-  }
+// Bitset of the given components, built at compile time so has<A, B>() is a
+// single mask compare
+template <typename... Ts> constexpr ComponentBitSet mask() noexcept {
+  return ComponentBitSet(((1ULL << get_type_id<Ts>()) | ... | 0ULL));
+}
+} // namespace components
 
-  virtual void onAttach() {}
-  virtual ~BaseComponent() {}
-};
+// Components are plain data, this only exists to mark a type as one.
+//
+// There is no vtable or back pointer, lifecycle hooks are dispatched by the
+// owning ComponentPool instead:
+// - a component can define `void onAttach(Entity &)` and it will be called
+//   right after it is added
+// - anything else can subscribe to a pool's on_add / on_remove
+struct BaseComponent {};
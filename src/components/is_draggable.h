@@ -2,6 +2,4 @@
 
 #include "base_component.h"
 
-struct IsDraggable : public BaseComponent {
-  virtual ~IsDraggable() {}
-};
+struct IsDraggable : public BaseComponent {};
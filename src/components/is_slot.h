@@ -1,12 +1,11 @@
 
 #pragma once
 
+#include "../entity_handle.h"
 #include "base_component.h"
 
 struct IsSlot : public BaseComponent {
-  virtual ~IsSlot() {}
+  EntityHandle held_entity;
 
-  int held_entity = -1;
-
-  [[nodiscard]] bool is_empty() const { return held_entity == -1; }
+  [[nodiscard]] bool is_empty() const { return held_entity.is_null(); }
 };
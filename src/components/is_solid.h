@@ -0,0 +1,6 @@
+#pragma once
+
+#include "base_component.h"
+
+// Blocks movement, the OccupancyGrid marks every tile its Transform covers
+struct IsSolid : public BaseComponent {};
@@ -31,6 +31,4 @@ struct RenderTags : public BaseComponent {
   [[nodiscard]] bool missing_tag(RenderTagType type) const {
     return !has_tag(type);
   }
-
-  virtual ~RenderTags() {}
 };
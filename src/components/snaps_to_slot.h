@@ -1,10 +1,8 @@
 #pragma once
 
+#include "../entity_handle.h"
 #include "base_component.h"
 
 struct SnapsToSlot : public BaseComponent {
-
-  virtual ~SnapsToSlot() {}
-
-  int held_by = -1;
+  EntityHandle held_by;
 };
@@ -5,8 +5,6 @@
 #include "base_component.h"
 
 struct Transform : public BaseComponent {
-  virtual ~Transform() {}
-
   vec2 size = {1.f, 1.f};
   vec2 position;
   float z_index = 0;
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "vec_util.h"
+
+// Distance math over positions laid out as separate x / y arrays, so a range
+// or nearest scan handles a whole register of entities per instruction
+// instead of one.
+//
+// Uses AVX when the build enables it (-mavx), SSE2 otherwise on x86-64 and a
+// plain loop everywhere else. Every path computes dx * dx + dy * dy in the
+// same order so they agree with vec::distance_sq bit for bit. A NaN position
+// is never in range and never nearest, use that for padding.
+namespace vec::batch {
+
+#if defined(__AVX__)
+constexpr size_t WIDTH = 8;
+#elif defined(__SSE2__)
+constexpr size_t WIDTH = 4;
+#else
+constexpr size_t WIDTH = 1;
+#endif
+
+// out[i] = squared distance from `p` to (xs[i], ys[i])
+inline void distance_sq(const float *xs, const float *ys, size_t n, vec2 p,
+                        float *out) {
+  size_t i = 0;
+#if defined(__AVX__)
+  const __m256 px = _mm256_set1_ps(p.x);
+  const __m256 py = _mm256_set1_ps(p.y);
+  for (; i + 8 <= n; i += 8) {
+    const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs + i), px);
+    const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys + i), py);
+    _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(dx, dx),
+                                            _mm256_mul_ps(dy, dy)));
+  }
+#elif defined(__SSE2__)
+  const __m128 px = _mm_set1_ps(p.x);
+  const __m128 py = _mm_set1_ps(p.y);
+  for (; i + 4 <= n; i += 4) {
+    const __m128 dx = _mm_sub_ps(_mm_loadu_ps(xs + i), px);
+    const __m128 dy = _mm_sub_ps(_mm_loadu_ps(ys + i), py);
+    _mm_storeu_ps(out + i,
+                  _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = vec::distance_sq(p, {xs[i], ys[i]});
+}
+
+// mask[i] = 1 when (xs[i], ys[i]) is closer to `p` than `range`, same test
+// as vec::distance(p, pos) < range. Returns how many are
+inline size_t within(const float *xs, const float *ys, size_t n, vec2 p,
+                     float range, uint8_t *mask) {
+  size_t count = 0;
+  if (!(range > 0)) {
+    for (size_t i = 0; i < n; i++)
+      mask[i] = 0;
+    return 0;
+  }
+  const float range_sq = range * range;
+  size_t i = 0;
+#if defined(__AVX__)
+  const __m256 px = _mm256_set1_ps(p.x);
+  const __m256 py = _mm256_set1_ps(p.y);
+  const __m256 r = _mm256_set1_ps(range_sq);
+  for (; i + 8 <= n; i += 8) {
+    const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs + i), px);
+    const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys + i), py);
+    const __m256 d =
+        _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+    // ordered compare, NaN is never in range
+    const int bits = _mm256_movemask_ps(_mm256_cmp_ps(d, r, _CMP_LT_OQ));
+    for (size_t j = 0; j < 8; j++)
+      mask[i + j] = static_cast<uint8_t>((bits >> j) & 1);
+    count += static_cast<size_t>(__builtin_popcount(bits));
+  }
+#elif defined(__SSE2__)
+  const __m128 px = _mm_set1_ps(p.x);
+  const __m128 py = _mm_set1_ps(p.y);
+  const __m128 r = _mm_set1_ps(range_sq);
+  for (; i + 4 <= n; i += 4) {
+    const __m128 dx = _mm_sub_ps(_mm_loadu_ps(xs + i), px);
+    const __m128 dy = _mm_sub_ps(_mm_loadu_ps(ys + i), py);
+    const __m128 d = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+    const int bits = _mm_movemask_ps(_mm_cmplt_ps(d, r));
+    for (size_t j = 0; j < 4; j++)
+      mask[i + j] = static_cast<uint8_t>((bits >> j) & 1);
+    count += static_cast<size_t>(__builtin_popcount(bits));
+  }
+#endif
+  for (; i < n; i++) {
+    mask[i] = vec::distance_sq(p, {xs[i], ys[i]}) < range_sq;
+    count += mask[i];
+  }
+  return count;
+}
+
+// Index and squared distance of the closest of the n positions, the first
+// one on ties. {n, inf} when there is nothing (or only NaNs)
+inline std::pair<size_t, float> nearest(const float *xs, const float *ys,
+                                        size_t n, vec2 p) {
+  float best = std::numeric_limits<float>::infinity();
+  size_t best_index = n;
+  size_t i = 0;
+#if defined(__AVX__) || defined(__SSE2__)
+  // every lane keeps its own minimum and where it was, they are combined
+  // once at the end. Indices ride along as raw bits in a float register
+  alignas(32) float lane_min[WIDTH];
+  alignas(32) int32_t lane_index[WIDTH];
+#if defined(__AVX__)
+  const __m256 px = _mm256_set1_ps(p.x);
+  const __m256 py = _mm256_set1_ps(p.y);
+  __m256 vmin = _mm256_set1_ps(best);
+  __m256 vindex = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  for (; i + 8 <= n; i += 8) {
+    const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs + i), px);
+    const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys + i), py);
+    const __m256 d =
+        _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+    const __m256 closer = _mm256_cmp_ps(d, vmin, _CMP_LT_OQ);
+    const int32_t at = static_cast<int32_t>(i);
+    const __m256 index = _mm256_castsi256_ps(_mm256_setr_epi32(
+        at, at + 1, at + 2, at + 3, at + 4, at + 5, at + 6, at + 7));
+    vmin = _mm256_blendv_ps(vmin, d, closer);
+    vindex = _mm256_blendv_ps(vindex, index, closer);
+  }
+  _mm256_store_ps(lane_min, vmin);
+  _mm256_store_ps(reinterpret_cast<float *>(lane_index), vindex);
+#else
+  const __m128 px = _mm_set1_ps(p.x);
+  const __m128 py = _mm_set1_ps(p.y);
+  __m128 vmin = _mm_set1_ps(best);
+  __m128 vindex = _mm_castsi128_ps(_mm_set1_epi32(-1));
+  for (; i + 4 <= n; i += 4) {
+    const __m128 dx = _mm_sub_ps(_mm_loadu_ps(xs + i), px);
+    const __m128 dy = _mm_sub_ps(_mm_loadu_ps(ys + i), py);
+    const __m128 d = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+    const __m128 closer = _mm_cmplt_ps(d, vmin);
+    const int32_t at = static_cast<int32_t>(i);
+    const __m128 index =
+        _mm_castsi128_ps(_mm_setr_epi32(at, at + 1, at + 2, at + 3));
+    // no blendv before SSE4.1
+    vmin = _mm_or_ps(_mm_and_ps(closer, d), _mm_andnot_ps(closer, vmin));
+    vindex =
+        _mm_or_ps(_mm_and_ps(closer, index), _mm_andnot_ps(closer, vindex));
+  }
+  _mm_store_ps(lane_min, vmin);
+  _mm_store_ps(reinterpret_cast<float *>(lane_index), vindex);
+#endif
+  for (size_t j = 0; j < WIDTH; j++) {
+    if (lane_index[j] < 0)
+      continue;
+    const size_t index = static_cast<size_t>(lane_index[j]);
+    if (lane_min[j] < best || (lane_min[j] == best && index < best_index)) {
+      best = lane_min[j];
+      best_index = index;
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    const float d = vec::distance_sq(p, {xs[i], ys[i]});
+    if (d < best) {
+      best = d;
+      best_index = i;
+    }
+  }
+  return {best_index, best};
+}
+
+} // namespace vec::batch
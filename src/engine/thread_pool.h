@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for splitting one big loop across cores.
+//
+// There is no general task queue, the only thing it does is parallel_for:
+// the calling thread posts a job, helps run it and returns once every chunk
+// is done, so a job never outlives the stack frame that started it.
+//
+// Jobs dont nest, calling parallel_for from inside a chunk runs that inner
+// loop on the calling thread.
+struct ThreadPool {
+  [[nodiscard]] static ThreadPool &get() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+  }
+
+  explicit ThreadPool(unsigned int num_threads) {
+    // the thread calling parallel_for is one of the workers
+    for (unsigned int i = 1; i < num_threads; i++)
+      workers.emplace_back([this] { work(); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake_workers.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  [[nodiscard]] size_t num_threads() const { return workers.size() + 1; }
+
+  // Calls fn(chunk) for every chunk in [0, num_chunks) spread over all
+  // threads, blocks until all of them finished
+  void parallel_for(size_t num_chunks, const std::function<void(size_t)> &fn) {
+    if (num_chunks == 0)
+      return;
+    if (num_chunks == 1 || workers.empty() || in_job) {
+      for (size_t i = 0; i < num_chunks; i++)
+        fn(i);
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    // only one job at a time
+    job_done.wait(lock, [this] { return job == nullptr; });
+    job = &fn;
+    job_chunks = num_chunks;
+    next_chunk = 0;
+    chunks_left = num_chunks;
+    generation++;
+    lock.unlock();
+    wake_workers.notify_all();
+
+    const size_t done = run_chunks(fn, num_chunks);
+
+    lock.lock();
+    chunks_left -= done;
+    // workers still holding `fn` have to let go before it goes out of scope
+    job_done.wait(lock, [this] { return chunks_left == 0 && active == 0; });
+    job = nullptr;
+    lock.unlock();
+    job_done.notify_all();
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake_workers;
+  std::condition_variable job_done;
+
+  const std::function<void(size_t)> *job = nullptr;
+  size_t job_chunks = 0;
+  size_t generation = 0;
+  bool stopping = false;
+  std::atomic<size_t> next_chunk = 0;
+  size_t chunks_left = 0;
+  // workers currently inside the job
+  size_t active = 0;
+
+  inline static thread_local bool in_job = false;
+
+  // Claims chunks until there are none left, returns how many it ran
+  size_t run_chunks(const std::function<void(size_t)> &fn, size_t num_chunks) {
+    in_job = true;
+    size_t done = 0;
+    for (size_t i = next_chunk++; i < num_chunks; i = next_chunk++) {
+      fn(i);
+      done++;
+    }
+    in_job = false;
+    return done;
+  }
+
+  void work() {
+    size_t seen = 0;
+    while (true) {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake_workers.wait(lock, [&] {
+        return stopping || (job && generation != seen);
+      });
+      if (stopping)
+        return;
+      seen = generation;
+      const std::function<void(size_t)> *fn = job;
+      size_t num_chunks = job_chunks;
+      active++;
+      lock.unlock();
+
+      const size_t done = run_chunks(*fn, num_chunks);
+
+      lock.lock();
+      chunks_left -= done;
+      active--;
+      if (chunks_left == 0 && active == 0)
+        job_done.notify_all();
+    }
+  }
+};
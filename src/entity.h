@@ -2,35 +2,45 @@
 
 #include <array>
 #include <bitset>
+#include <tuple>
 
 #include "components/base_component.h"
+#include "component_storage.h"
 #include "engine/assert.h"
 #include "engine/log.h"
 #include "engine/type_name.h"
+#include "entity_handle.h"
 #include "entity_type.h"
 
-using ComponentBitSet = std::bitset<max_num_components>;
-using ComponentArray = std::array<BaseComponent *, max_num_components>;
-
-static std::atomic_int ENTITY_ID_GEN = 0;
-
 struct Entity {
   bool cleanup = false;
+  // survives delete_all_entities()
+  bool permanent = false;
   int id;
+  EntityHandle handle;
+  // position inside EntityHelper::get_entities(), lets destruction swap and
+  // pop instead of searching the list
+  int list_index = -1;
 
   EntityType type = EntityType::Unknown;
 
   ComponentBitSet componentSet;
-  ComponentArray componentArray;
 
-  Entity() : id(ENTITY_ID_GEN++) {}
+  // Entities are created by the EntityPool inside EntityHelper which owns the
+  // id generator and the slot the handle points at
+  Entity(int _id, EntityHandle _handle) : id(_id), handle(_handle) {}
   ~Entity() {
-    for (auto &ptr : componentArray) {
-      delete ptr;
+    if (componentSet.none())
+      return;
+    for (ComponentID i = 0; i < max_num_components; i++) {
+      if (!componentSet[i])
+        continue;
+      ComponentStorage::detach(i, *this, handle.index);
     }
   }
+  // Pools keep a pointer back to the owning entity so it cant move
   Entity(const Entity &) = delete;
-  Entity(Entity &&other) noexcept = default;
+  Entity(Entity &&other) = delete;
 
   // These two functions can be used to validate than an entity has all of the
   // matching components that are needed for this system to run
@@ -44,7 +54,8 @@ struct Entity {
   }
 
   template <typename A, typename B, typename... Rest> bool has() const {
-    return has<A>() && has<B, Rest...>();
+    constexpr ComponentBitSet required = components::mask<A, B, Rest...>();
+    return (componentSet & required) == required;
   }
 
   template <typename T> [[nodiscard]] bool is_missing() const {
@@ -65,12 +76,13 @@ struct Entity {
       log_error("trying to remove but this entity {} {} doesnt have the "
                 "component attached {} {}",
                 name(), id, components::get_type_id<T>(), type_name<T>());
+      // nothing to remove, listeners must not hear about it either
+      return;
     }
+    ComponentPool<T> &pool = ComponentStorage::get<T>();
+    pool.notify_remove(*this);
     componentSet[components::get_type_id<T>()] = false;
-    BaseComponent *ptr = componentArray[components::get_type_id<T>()];
-    componentArray[components::get_type_id<T>()] = nullptr;
-    if (ptr)
-      delete ptr;
+    pool.remove(handle.index);
   }
 
   template <typename T, typename... TArgs> T &addComponent(TArgs &&...args) {
@@ -92,15 +104,17 @@ struct Entity {
       // return this->get<T>();
     }
 
-    T *component(new T(std::forward<TArgs>(args)...));
-    componentArray[components::get_type_id<T>()] = component;
+    ComponentPool<T> &pool = ComponentStorage::get<T>();
+    pool.emplace(this, handle.index, std::forward<TArgs>(args)...);
     componentSet[components::get_type_id<T>()] = true;
 
     log_trace("your set is now {}", componentSet);
 
-    component->attach_parent(this);
+    run_attach_hooks<T>();
 
-    return *component;
+    // hooks are allowed to add more of T which can move our row. The caller
+    // is probably about to fill it in so it counts as a write
+    return pool.get_mut(handle.index);
   }
 
   template <typename A> void addAll() { addComponent<A>(); }
@@ -110,6 +124,22 @@ struct Entity {
     addAll<B, Rest...>();
   }
 
+  // Copies in a whole set of components at once, this is what prefab
+  // spawning uses. Skips the per component logging and updates the bitset
+  // with a single write
+  template <typename... Ts>
+  void addComponentsFrom(const std::tuple<Ts...> &values) {
+    constexpr ComponentBitSet added = components::mask<Ts...>();
+    VALIDATE((componentSet & added).none(), "duplicate component");
+
+    (ComponentStorage::get<Ts>().emplace(this, handle.index,
+                                         std::get<Ts>(values)),
+     ...);
+    componentSet |= added;
+
+    (run_attach_hooks<Ts>(), ...);
+  }
+
   const std::string_view name() const {
     return magic_enum::enum_name<EntityType>(type);
   }
@@ -122,21 +152,43 @@ struct Entity {
     }
   }
 
-  template <typename T> [[nodiscard]] T &get() {
+  // A plain read, it does not count as a change. Write through get_mut()
+  template <typename T> [[nodiscard]] const T &get() const {
     warnIfMissingComponent<T>();
-    BaseComponent *comp = componentArray.at(components::get_type_id<T>());
-    return *static_cast<T *>(comp);
+    return ComponentStorage::get<T>().get(handle.index);
   }
 
-  template <typename T> [[nodiscard]] const T &get() const {
+  // Stamps the component as changed this tick and tells whoever tracks
+  // writes to it (SpatialGrid and friends), so only use it to write
+  template <typename T> [[nodiscard]] T &get_mut() {
     warnIfMissingComponent<T>();
-    BaseComponent *comp = componentArray.at(components::get_type_id<T>());
-    return *static_cast<T *>(comp);
+    return ComponentStorage::get<T>().get_mut(handle.index);
+  }
+
+  template <typename T> void markChanged() {
+    ComponentStorage::get<T>().mark_changed(handle.index);
+  }
+
+  template <typename T> [[nodiscard]] bool changedSince(Tick since) const {
+    return ComponentStorage::get<T>().changed_since(handle.index, since);
+  }
+
+  template <typename T> [[nodiscard]] bool addedSince(Tick since) const {
+    return ComponentStorage::get<T>().added_since(handle.index, since);
   }
 
   static bool check_type(const Entity &entity, EntityType other_type) {
     return other_type == entity.type;
   }
+
+private:
+  template <typename T> void run_attach_hooks() {
+    ComponentPool<T> &pool = ComponentStorage::get<T>();
+    if constexpr (requires(T &component) { component.onAttach(*this); }) {
+      pool.get(handle.index).onAttach(*this);
+    }
+    pool.notify_add(*this);
+  }
 };
 
 using RefEntity = std::reference_wrapper<Entity>;
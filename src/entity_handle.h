@@ -0,0 +1,25 @@
+#pragma once
+
+#include <ostream>
+
+// Stable reference to an entity owned by the world.
+//
+// `index` is the slot the entity lives in, `generation` is bumped every time
+// that slot is reused, so a handle to a destroyed entity resolves to nothing
+// instead of to whatever took its place.
+struct EntityHandle {
+  int index = -1;
+  int generation = 0;
+
+  [[nodiscard]] bool is_null() const { return index == -1; }
+  [[nodiscard]] bool valid() const { return !is_null(); }
+
+  bool operator==(const EntityHandle &other) const = default;
+
+  [[nodiscard]] static EntityHandle null() { return {}; }
+};
+
+inline std::ostream &operator<<(std::ostream &os, const EntityHandle &h) {
+  os << "EntityHandle<" << h.index << ", " << h.generation << ">";
+  return os;
+}
@@ -1,14 +1,80 @@
 #include "entity_helper.h"
 
+#include "aabb_tree.h"
+#include "components/is_solid.h"
 #include "components/transform.h"
+#include "distance_kernels.h"
+#include "entity_pool.h"
 #include "entity_query.h"
+#include "occupancy_grid.h"
+#include "static_query.h"
 
+#include <cmath>
 #include <set>
 
 Entities entities_DO_NOT_USE;
 
-std::set<int> permanant_ids;
-std::map<vec2, bool> cache_is_walkable;
+// Owns every entity, EntityHandle indexes straight into it
+EntityPool entity_pool;
+std::unordered_map<int, EntityHandle> handles_by_id;
+int next_entity_id = 0;
+
+// Entities marked for cleanup since the last cleanup()
+std::vector<EntityHandle> pending_cleanup;
+size_t num_permanent = 0;
+// Bumped whenever an entity is created or destroyed
+uint64_t world_version = 0;
+
+void destroy_entity(Entity *e) {
+  if (e->permanent)
+    num_permanent--;
+  handles_by_id.erase(e->id);
+  entity_pool.destroy(e);
+  world_version++;
+}
+
+void reindex_entities(Entities &entities) {
+  for (size_t i = 0; i < entities.size(); i++) {
+    entities[i]->list_index = static_cast<int>(i);
+  }
+}
+
+// Swaps the entity with the last one in the list and pops it, so the list
+// does not keep creation order
+void unlist_entity(Entities &entities, Entity *e) {
+  int index = e->list_index;
+  // someone (like PreRenderingSystem) reordered the list since we last
+  // looked, fix every index once and keep going
+  if (index < 0 || index >= static_cast<int>(entities.size()) ||
+      entities[index] != e) {
+    reindex_entities(entities);
+    index = e->list_index;
+  }
+
+  Entity *last = entities.back();
+  entities[index] = last;
+  last->list_index = index;
+  entities.pop_back();
+  e->list_index = -1;
+}
+
+// Destroys every entity matching `pred` and compacts the list in place,
+// keeping the survivors in order
+template <typename Pred>
+void destroy_matching(Entities &entities, const Pred &pred) {
+  size_t kept = 0;
+  for (Entity *e : entities) {
+    if (!e)
+      continue;
+    if (pred(*e)) {
+      destroy_entity(e);
+      continue;
+    }
+    e->list_index = static_cast<int>(kept);
+    entities[kept++] = e;
+  }
+  entities.resize(kept);
+}
 
 ///////////////////////////////////
 ///
@@ -18,6 +84,8 @@ std::map<vec2, bool> cache_is_walkable;
 
 Entities &EntityHelper::get_entities() { return entities_DO_NOT_USE; }
 
+uint64_t EntityHelper::structure_version() { return world_version; }
+
 RefEntities EntityHelper::get_ref_entities() {
   RefEntities matching;
   for (const auto &e : EntityHelper::get_entities()) {
@@ -41,72 +109,87 @@ Entity &EntityHelper::createPermanentEntity() {
 }
 
 Entity &EntityHelper::createEntityWithOptions(const CreationOptions &options) {
-  std::shared_ptr<Entity> e(new Entity());
-  get_entities().push_back(e);
-  // log_info("created a new entity {}", e->id);
+  Entity *e = entity_pool.create(next_entity_id++);
+  e->permanent = options.is_permanent;
+  if (e->permanent)
+    num_permanent++;
+  handles_by_id[e->id] = e->handle;
+  world_version++;
 
-  if (options.is_permanent) {
-    permanant_ids.insert(e->id);
-  }
+  Entities &entities = get_entities();
+  e->list_index = static_cast<int>(entities.size());
+  entities.push_back(e);
+  // log_info("created a new entity {}", e->id);
 
   return *e;
 }
 
-void EntityHelper::markIDForCleanup(int e_id) {
-  auto &entities = get_entities();
-  auto it = entities.begin();
-  while (it != get_entities().end()) {
-    if ((*it)->id == e_id) {
-      (*it)->cleanup = true;
-      break;
-    }
-    it++;
-  }
+void EntityHelper::reserveEntities(size_t amount) {
+  entity_pool.reserve(amount);
+  get_entities().reserve(get_entities().size() + amount);
+  handles_by_id.reserve(handles_by_id.size() + amount);
 }
 
-void EntityHelper::removeEntity(int e_id) {
-  auto &entities = get_entities();
+void EntityHelper::markIDForCleanup(int e_id) {
+  OptEntity e = getEntityForID(e_id);
+  if (!e)
+    return;
+  markForCleanup(e.asE());
+}
 
-  auto newend = std::remove_if(
-      entities.begin(), entities.end(),
-      [e_id](const auto &entity) { return !entity || entity->id == e_id; });
+void EntityHelper::markForCleanup(Entity &entity) {
+  if (entity.cleanup)
+    return;
+  entity.cleanup = true;
+  pending_cleanup.push_back(entity.handle);
+}
 
-  entities.erase(newend, entities.end());
+void EntityHelper::removeEntity(int e_id) {
+  OptEntity e = getEntityForID(e_id);
+  if (!e)
+    return;
+  unlist_entity(get_entities(), e.value());
+  destroy_entity(e.value());
 }
 
 void EntityHelper::cleanup() {
   // Cleanup entities marked cleanup
   Entities &entities = get_entities();
-
-  auto newend =
-      std::remove_if(entities.begin(), entities.end(), [](const auto &entity) {
-        return !entity || entity->cleanup;
-      });
-
-  entities.erase(newend, entities.end());
+  for (EntityHandle handle : pending_cleanup) {
+    Entity *e = entity_pool.resolve(handle);
+    // already removed some other way
+    if (!e)
+      continue;
+    unlist_entity(entities, e);
+    destroy_entity(e);
+  }
+  pending_cleanup.clear();
 }
 
 void EntityHelper::delete_all_entities_NO_REALLY_I_MEAN_ALL() {
-  Entities &entities = get_entities();
-  // just clear the whole thing
-  entities.clear();
+  // just clear the whole thing, wipe the pools wholesale and then release
+  // the entities without having them detach one component at a time
+  ComponentStorage::clear_all();
+  for (Entity *e : get_entities()) {
+    e->componentSet.reset();
+  }
+  entity_pool.destroy_all();
+  handles_by_id.clear();
+  pending_cleanup.clear();
+  num_permanent = 0;
+  world_version++;
+  get_entities().clear();
 }
 
 void EntityHelper::delete_all_entities(bool include_permanent) {
-  if (include_permanent) {
+  if (include_permanent || num_permanent == 0) {
     delete_all_entities_NO_REALLY_I_MEAN_ALL();
     return;
   }
 
   // Only delete non perms
-  Entities &entities = get_entities();
-
-  auto newend =
-      std::remove_if(entities.begin(), entities.end(), [](const auto &entity) {
-        return !permanant_ids.contains(entity->id);
-      });
-
-  entities.erase(newend, entities.end());
+  destroy_matching(get_entities(),
+                   [](const Entity &entity) { return !entity.permanent; });
 }
 
 enum ForEachFlow {
@@ -127,17 +210,27 @@ void EntityHelper::forEachEntity(std::function<ForEachFlow(Entity &)> cb) {
   }
 }
 
+bool EntityHelper::isWalkable(vec2 pos) {
+  OccupancyGrid &grid = OccupancyGrid::get();
+  grid.sync();
+  return grid.is_walkable(OccupancyGrid::tile_of(pos));
+}
+
 OptEntity EntityHelper::getEntityForID(int id) {
-  if (id == -1)
+  if (id < 0)
     return {};
 
-  for (const auto &e : get_entities()) {
-    if (!e)
-      continue;
-    if (e->id == id)
-      return *e;
-  }
-  return {};
+  auto it = handles_by_id.find(id);
+  if (it == handles_by_id.end())
+    return {};
+  return getEntityForHandle(it->second);
+}
+
+OptEntity EntityHelper::getEntityForHandle(EntityHandle handle) {
+  Entity *e = entity_pool.resolve(handle);
+  if (!e)
+    return {};
+  return *e;
 }
 
 OptEntity EntityHelper::getClosestOfType(const Entity &entity,
@@ -151,51 +244,122 @@ OptEntity EntityHelper::getClosestOfType(const Entity &entity,
 
 // TODO :BE: change other debugname filter guys to this
 std::vector<RefEntity> EntityHelper::getAllWithType(const EntityType &type) {
-  return EntityQuery().whereType(type).gen();
+  return StaticQuery<>().whereType(type).gen();
 }
 
 bool EntityHelper::doesAnyExistWithType(const EntityType &type) {
-  return EntityQuery().whereType(type).has_values();
+  return StaticQuery<>().whereType(type).has_values();
+}
+
+// Positions of a run of entities copied out into x / y arrays for the
+// vec::batch kernels, anything without a Transform gets NaN so it never
+// matches
+struct PositionBlock {
+  static constexpr size_t SIZE = 256;
+  std::array<float, SIZE> xs;
+  std::array<float, SIZE> ys;
+  std::span<Entity *const> entities;
+};
+
+template <typename Fn>
+void for_each_position_block(std::span<Entity *const> entities, Fn &&fn) {
+  const ComponentPool<Transform> &transforms =
+      ComponentStorage::get<Transform>();
+  PositionBlock block;
+  for (size_t start = 0; start < entities.size();
+       start += PositionBlock::SIZE) {
+    block.entities = entities.subspan(
+        start, std::min(PositionBlock::SIZE, entities.size() - start));
+    for (size_t i = 0; i < block.entities.size(); i++) {
+      const Entity *entity = block.entities[i];
+      const int index =
+          entity ? transforms.index_of(entity->handle.index) : -1;
+      if (index == -1) {
+        block.xs[i] = block.ys[i] = std::numeric_limits<float>::quiet_NaN();
+        continue;
+      }
+      const vec2 position = transforms.data[index].as2();
+      block.xs[i] = position.x;
+      block.ys[i] = position.y;
+    }
+    fn(block);
+  }
+}
+
+// Everything that could be within `range` of `pos`, the grid cells around
+// it when that is smaller than every Transform. Nothing is in a range that
+// is not above zero (or NaN), an infinite one is every Transform
+std::span<Entity *const> in_range_candidates(vec2 pos, float range,
+                                             Entities &scratch) {
+  const BaseComponentPool &transforms = ComponentStorage::get<Transform>();
+  scratch.clear();
+  if (!(range > 0))
+    return scratch;
+  if (std::isinf(range))
+    return transforms.owners;
+  const query::Box box = query::InRange{pos, range}.bounds();
+  if (query::grid_candidates(box, transforms.size(), scratch))
+    return scratch;
+  return transforms.owners;
 }
 
 std::vector<RefEntity> EntityHelper::getFilteredEntitiesInRange(
     vec2 pos, float range, const std::function<bool(const Entity &)> &filter) {
-  return EntityQuery().whereLambda(filter).whereInRange(pos, range).gen();
+  Entities scratch;
+  RefEntities out;
+  std::array<uint8_t, PositionBlock::SIZE> inside;
+  for_each_position_block(
+      in_range_candidates(pos, range, scratch), [&](const PositionBlock &b) {
+        if (!vec::batch::within(b.xs.data(), b.ys.data(), b.entities.size(),
+                                pos, range, inside.data()))
+          return;
+        for (size_t i = 0; i < b.entities.size(); i++) {
+          if (inside[i] && (!filter || filter(*b.entities[i])))
+            out.push_back(*b.entities[i]);
+        }
+      });
+  return out;
 }
 
 std::vector<RefEntity> EntityHelper::getEntitiesInRange(vec2 pos, float range) {
-  return EntityQuery().whereInRange(pos, range).gen();
+  return getFilteredEntitiesInRange(pos, range, {});
 }
 
 OptEntity EntityHelper::getClosestMatchingEntity(
     vec2 pos, float range, const std::function<bool(const Entity &)> &filter) {
-  // TODO We dont currently support order by
-  //      and even if we did it would be two full loops
-  /*
-  EntityQuery()
-  .whereLambda(filter)
-  .whereInRange(pos, range)
-  .orderBy(Distance)
-  .gen_first()
-  ;
-  */
-
-  float best_distance = range;
-  OptEntity best_so_far = {};
-  for (auto &e : get_entities()) {
-    if (!e)
-      continue;
-    if (!filter(*e))
-      continue;
-    float d = vec::distance(pos, e->get<Transform>().as2());
-    if (d > range)
-      continue;
-    if (d < best_distance) {
-      best_so_far = *e;
-      best_distance = d;
+  Entities scratch;
+  return getClosestMatchingEntity(in_range_candidates(pos, range, scratch),
+                                  pos, range, filter);
+}
+
+OptEntity EntityHelper::getClosestMatchingEntity(
+    std::span<Entity *const> candidates, vec2 pos, float range,
+    const std::function<bool(const Entity &)> &filter) {
+  if (!(range > 0))
+    return {};
+  Entity *best = nullptr;
+  // only ever shrinks, starts out as the range so that is checked for free
+  float best_sq = range * range;
+  std::array<float, PositionBlock::SIZE> dist_sq;
+  for_each_position_block(candidates, [&](const PositionBlock &b) {
+    const size_t n = b.entities.size();
+    // nothing in here is closer than what we have, skip the filter calls
+    if (vec::batch::nearest(b.xs.data(), b.ys.data(), n, pos).second >=
+        best_sq)
+      return;
+    vec::batch::distance_sq(b.xs.data(), b.ys.data(), n, pos, dist_sq.data());
+    for (size_t i = 0; i < n; i++) {
+      if (!(dist_sq[i] < best_sq))
+        continue;
+      if (filter && !filter(*b.entities[i]))
+        continue;
+      best = b.entities[i];
+      best_sq = dist_sq[i];
     }
-  }
-  return best_so_far;
+  });
+  if (!best)
+    return {};
+  return *best;
 }
 
 bool EntityHelper::hasOverlappingSolidEntitiesInRange(vec2 range_min,
@@ -208,44 +372,34 @@ bool EntityHelper::hasOverlappingSolidEntitiesInRange(vec2 range_min,
 RefEntities EntityHelper::getAllInRangeFiltered(
     vec2 range_min, vec2 range_max,
     const std::function<bool(const Entity &)> &filter) {
-  return EntityQuery()
+  return StaticQuery<>()
       .whereInside(range_min, range_max)
       .whereLambda(filter)
       .gen();
 }
 
 RefEntities EntityHelper::getAllInRange(vec2 range_min, vec2 range_max) {
-  return EntityQuery().whereInside(range_min, range_max).gen();
-}
-
-// TODO :EQ_CPP: We cant expose this function direction because
-// EntityQuery cant be including in entity helper du eot circular
-// need to move into a cpp
-EntityQuery &getOverlappingSolidEntityInRangeQuery(
-    vec2 range_min, vec2 range_max,
-    const std::function<bool(const Entity &)> &filter) {
-  return EntityQuery() //
-                       //// TODO
-      // .whereHasComponent<IsSolid>()      //
-      .whereInside(range_min, range_max) //
-      .whereLambdaExistsAndTrue(filter)  //
-      .whereLambda([&](const Entity &entity) -> bool {
-        return EntityQuery()       //
-            .whereNotID(entity.id) //
-                                   // TODO
-            // .whereHasComponent<IsSolid>()      //
-            .whereInside(range_min, range_max) //
-            .wherePositionMatches(entity)      //
-            .first()                           //
-            .has_values();
-      });
+  return StaticQuery<>().whereInside(range_min, range_max).gen();
 }
 
 OptEntity EntityHelper::getOverlappingSolidEntityInRange(
     vec2 range_min, vec2 range_max,
     const std::function<bool(const Entity &)> &filter) {
-  return getOverlappingSolidEntityInRangeQuery(range_min, range_max, filter)
-      .gen_first();
+  const raylib::Rectangle region{range_min.x, range_min.y,
+                                 range_max.x - range_min.x,
+                                 range_max.y - range_min.y};
+  AABBTree &tree = AABBTree::get();
+  tree.sync();
+  OptEntity found;
+  tree.for_each_pair(region, [&](Entity &a, Entity &b) {
+    if (found || !a.has<IsSolid>() || !b.has<IsSolid>())
+      return;
+    if (!filter || filter(a))
+      found = a;
+    else if (filter(b))
+      found = b;
+  });
+  return found;
 }
 
 OptEntity EntityHelper::getOverlappingEntityIfExists(
@@ -3,6 +3,7 @@
 
 #include <map>
 #include <set>
+#include <span>
 #include <thread>
 
 #include "assert.h"
@@ -11,14 +12,14 @@
 //
 #include "components/transform.h"
 #include "entity.h"
+#include "prefab.h"
+#include "view.h"
 
-using Entities = std::vector<std::shared_ptr<Entity>>;
+using Entities = std::vector<Entity *>;
 using RefEntities = std::vector<RefEntity>;
 
 extern Entities client_entities_DO_NOT_USE;
 
-extern std::set<int> permanant_ids;
-
 struct EntityHelper {
   struct CreationOptions {
     bool is_permanent;
@@ -26,12 +27,46 @@ struct EntityHelper {
 
   static Entities &get_entities();
   static RefEntities get_ref_entities();
+  // Changes every time an entity is created or destroyed
+  static uint64_t structure_version();
 
   static Entity &createEntity();
   static Entity &createPermanentEntity();
   static Entity &createEntityWithOptions(const CreationOptions &options);
+  // Preallocates room for `amount` more entities in the entity pool
+  static void reserveEntities(size_t amount);
+
+  // Creates `count` entities from `prefab` then calls init(entity, i) on each.
+  // Storage for the entities and all of their components is reserved once up
+  // front so big scenes dont pay for thousands of small allocations
+  template <typename... Ts, typename Fn>
+  static void spawn_n(const Prefab<Ts...> &prefab, size_t count, Fn &&init) {
+    reserveEntities(count);
+    (ComponentStorage::get<Ts>().reserve(ComponentStorage::get<Ts>().size() +
+                                         count),
+     ...);
+
+    for (size_t i = 0; i < count; i++) {
+      Entity &e = createEntity();
+      e.type = prefab.type;
+      e.addComponentsFrom(prefab.defaults);
+      init(e, i);
+    }
+  }
 
+  template <typename... Ts>
+  static Entity &spawn(const Prefab<Ts...> &prefab,
+                       const CreationOptions &options = {
+                           .is_permanent = false}) {
+    Entity &e = createEntityWithOptions(options);
+    e.type = prefab.type;
+    e.addComponentsFrom(prefab.defaults);
+    return e;
+  }
+
+  // Marking is O(1), the entity is destroyed on the next cleanup()
   static void markIDForCleanup(int e_id);
+  static void markForCleanup(Entity &entity);
   static void removeEntity(int e_id);
   static void cleanup();
   static void delete_all_entities_NO_REALLY_I_MEAN_ALL();
@@ -45,6 +80,9 @@ struct EntityHelper {
 
   static void forEachEntity(std::function<ForEachFlow(Entity &)> cb);
 
+  // Iterates only entities that have all of Ts, see view.h
+  template <typename... Ts> static View<Ts...> view() { return {}; }
+
   static std::vector<RefEntity>
   getFilteredEntitiesInRange(vec2 pos, float range,
                              const std::function<bool(const Entity &)> &filter);
@@ -55,22 +93,16 @@ struct EntityHelper {
     return getEntitiesInRange(pos, 1);
   }
 
-  // TODO exists as a conversion for things that need shared_ptr right now
-  static std::shared_ptr<Entity> getEntityAsSharedPtr(OptEntity entity) {
-    if (!entity)
-      return {};
-    for (std::shared_ptr<Entity> current_entity : get_entities()) {
-      if (entity->id == current_entity->id)
-        return current_entity;
-    }
-    return {};
-  }
+  // False when a solid entity covers the OccupancyGrid tile at `pos`
+  static bool isWalkable(vec2 pos);
 
   static OptEntity getClosestMatchingFurniture(
       const Transform &transform, float range,
       const std::function<bool(const Entity &)> &filter);
 
   static OptEntity getEntityForID(int id);
+  // Resolves in O(1), returns nothing if that entity was since destroyed
+  static OptEntity getEntityForHandle(EntityHandle handle);
 
   static OptEntity getClosestOfType(const Entity &entity,
                                     const EntityType &type,
@@ -83,6 +115,11 @@ struct EntityHelper {
   static OptEntity
   getClosestMatchingEntity(vec2 pos, float range,
                            const std::function<bool(const Entity &)> &filter);
+  // Same but only looks at `candidates`, eg the result of a CachedQuery
+  static OptEntity
+  getClosestMatchingEntity(std::span<Entity *const> candidates, vec2 pos,
+                           float range,
+                           const std::function<bool(const Entity &)> &filter);
 
   template <typename T>
   static OptEntity getClosestWithComponent(const Entity &entity, float range) {
@@ -110,22 +147,18 @@ struct EntityHelper {
 
 private:
   template <typename T> static std::vector<RefEntity> getAllWithComponent() {
+    const auto matches = view<T>();
     std::vector<RefEntity> matching;
-    for (const auto &e : get_entities()) {
-      if (!e)
-        continue;
-      if (e->has<T>())
-        matching.push_back(*e);
+    matching.reserve(matches.size_hint());
+    for (Entity &e : matches) {
+      matching.push_back(e);
     }
     return matching;
   }
 
   template <typename T> static OptEntity getFirstWithComponent() {
-    for (const auto &e : get_entities()) {
-      if (!e)
-        continue;
-      if (e->has<T>())
-        return *e;
+    for (Entity &e : view<T>()) {
+      return e;
     }
     return {};
   }
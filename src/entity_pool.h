@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "entity.h"
+
+// Chunked allocator that owns every Entity.
+//
+// Entities are constructed in place inside fixed size chunks so their
+// addresses never change and there is no control block or refcount per
+// entity. The slot index doubles as the index part of the entity's
+// EntityHandle, and the per-slot generation is what makes stale handles fail
+// to resolve. Destroyed slots go on a free list and are reused first.
+struct EntityPool {
+  static constexpr int CHUNK_SIZE = 1024;
+
+  struct Slot {
+    alignas(Entity) std::byte storage[sizeof(Entity)];
+    int generation = 0;
+    bool alive = false;
+
+    [[nodiscard]] Entity *entity() {
+      return std::launder(reinterpret_cast<Entity *>(storage));
+    }
+  };
+  using Chunk = std::array<Slot, CHUNK_SIZE>;
+
+  EntityPool() {}
+  EntityPool(const EntityPool &) = delete;
+  EntityPool &operator=(const EntityPool &) = delete;
+  ~EntityPool() { destroy_all(); }
+
+  [[nodiscard]] Entity *create(int id) {
+    if (free_slots.empty())
+      grow();
+    int index = free_slots.back();
+    free_slots.pop_back();
+
+    Slot &s = slot(index);
+    Entity *e = new (s.storage)
+        Entity(id, {.index = index, .generation = s.generation});
+    s.alive = true;
+    num_alive++;
+    return e;
+  }
+
+  void destroy(Entity *e) {
+    int index = e->handle.index;
+    // components are keyed by slot so they go before the slot is reused
+    e->~Entity();
+
+    Slot &s = slot(index);
+    s.alive = false;
+    s.generation++;
+    free_slots.push_back(index);
+    num_alive--;
+  }
+
+  void destroy_all() {
+    for (int i = 0; i < capacity(); i++) {
+      if (slot(i).alive)
+        destroy(slot(i).entity());
+    }
+  }
+
+  [[nodiscard]] Entity *resolve(EntityHandle handle) {
+    if (handle.is_null() || handle.index >= capacity())
+      return nullptr;
+    Slot &s = slot(handle.index);
+    if (!s.alive || s.generation != handle.generation)
+      return nullptr;
+    return s.entity();
+  }
+
+  // Makes sure `amount` more entities can be created without allocating
+  void reserve(size_t amount) {
+    while (free_slots.size() < amount)
+      grow();
+  }
+
+  [[nodiscard]] int capacity() const {
+    return static_cast<int>(chunks.size()) * CHUNK_SIZE;
+  }
+  [[nodiscard]] size_t size() const { return num_alive; }
+
+private:
+  std::vector<std::unique_ptr<Chunk>> chunks;
+  std::vector<int> free_slots;
+  size_t num_alive = 0;
+
+  [[nodiscard]] Slot &slot(int index) {
+    return (*chunks[index / CHUNK_SIZE])[index % CHUNK_SIZE];
+  }
+
+  void grow() {
+    int start = capacity();
+    chunks.push_back(std::make_unique<Chunk>());
+    // pushed in reverse so the lowest index is handed out first
+    free_slots.reserve(free_slots.size() + CHUNK_SIZE);
+    for (int i = CHUNK_SIZE - 1; i >= 0; i--) {
+      free_slots.push_back(start + i);
+    }
+  }
+};
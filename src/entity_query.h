@@ -1,188 +1,177 @@
 
 #pragma once
 
+#include <atomic>
+#include <iterator>
+#include <limits>
+#include <span>
+
+#include "engine/thread_pool.h"
 #include "entity.h"
 #include "entity_helper.h"
 #include "entity_type.h"
+#include "query_predicates.h"
+#include "query_stats.h"
 
 struct EntityQuery {
   struct Modification {
     virtual ~Modification() {}
     virtual bool operator()(const Entity &) const = 0;
+    // Components every passing entity must have, lets run_query walk the
+    // smallest of those pools instead of the whole world
+    virtual ComponentBitSet required() const { return {}; }
+    virtual query::Cost cost() const { return query::Cost::Lambda; }
+    virtual std::optional<query::Box> bounds() const { return std::nullopt; }
+    virtual std::optional<raylib::Rectangle> overlap_area() const {
+      return std::nullopt;
+    }
   };
 
-  // TODO add predicates
-  struct Not : Modification {
-    std::unique_ptr<Modification> mod;
-
-    explicit Not(Modification *m) : mod(m) {}
-
+  // Adapts one of the query:: filters, StaticQuery uses them directly
+  template <typename P> struct Where : Modification {
+    P pred;
+    explicit Where(P p) : pred(std::move(p)) {}
     virtual bool operator()(const Entity &entity) const override {
-      return !((*mod)(entity));
+      return pred(entity);
     }
-  };
-
-  struct Limit : Modification {
-    int amount;
-    mutable int amount_taken;
-    explicit Limit(int amt) : amount(amt), amount_taken(0) {}
-
-    virtual bool operator()(const Entity &) const override {
-      if (amount_taken > amount)
-        return false;
-      amount_taken++;
-      return true;
+    virtual ComponentBitSet required() const override {
+      return query::required_of<P>();
+    }
+    virtual query::Cost cost() const override { return query::cost_of<P>(); }
+    virtual std::optional<query::Box> bounds() const override {
+      return query::bounds_of(pred);
+    }
+    virtual std::optional<raylib::Rectangle> overlap_area() const override {
+      return query::overlap_area_of(pred);
     }
   };
-  auto &take(int amount) { return add_mod(new Limit(amount)); }
+
+  // Applied after filtering (and ordering), not as one of the filters.
+  //
+  // Without orderBy() "first" means first found, and world queries dont walk
+  // the entity list when they can avoid it: rect filters go through the
+  // AABBTree, positional ones through the SpatialGrid cells and anything
+  // with a required component through that pool. So which of several
+  // matches comes back follows tree / cell / pool order, not list (or
+  // creation) order. Use orderBy() when it matters which one you get
+  auto &take(int amount) {
+    limit = static_cast<size_t>(std::max(amount, 0));
+    return *this;
+  }
   auto &first() { return take(1); }
 
-  struct WhereID : Modification {
-    int id;
-    explicit WhereID(int id) : id(id) {}
-    virtual bool operator()(const Entity &entity) const override {
-      return entity.id == id;
-    }
-  };
-  auto &whereID(int id) { return add_mod(new WhereID(id)); }
-  auto &whereNotID(int id) { return add_mod(new Not(new WhereID(id))); }
+  // Results come back lowest key first, equal keys in the order they were
+  // found. Combined with take(k) only the best k are kept while scanning
+  using OrderKey = std::function<float(const Entity &)>;
+  auto &orderBy(const OrderKey &key) {
+    order_key = key;
+    return *this;
+  }
+  auto &orderByDistance(vec2 position) {
+    return orderBy([position](const Entity &entity) {
+      return vec::distance(position, entity.get<Transform>().as2());
+    });
+  }
+  auto &nearest(vec2 position, int k = 1) {
+    return orderByDistance(position).take(k);
+  }
 
-  struct WhereType : Modification {
-    EntityType type;
-    explicit WhereType(const EntityType &t) : type(t) {}
-    virtual bool operator()(const Entity &entity) const override {
-      return Entity::check_type(entity, type);
-    }
-  };
-  auto &whereType(const EntityType &t) { return add_mod(new WhereType(t)); }
+  // Splits gen() / gen_first() over the ThreadPool once there are at least
+  // two chunks worth of entities to look at. Results are the same and come
+  // back in the same order as a serial run, take() / first() included.
+  //
+  // Filters run on several threads at once so they must only read,
+  // whereLambda callbacks included.
+  auto &parallel(size_t chunk_size = 4096) {
+    parallel_chunk = std::max<size_t>(chunk_size, 1);
+    return *this;
+  }
+
+  auto &whereID(int id) { return add_pred(query::ID{id}); }
+  auto &whereNotID(int id) {
+    return add_pred(query::Not<query::ID>{{id}});
+  }
+
+  auto &whereType(const EntityType &t) { return add_pred(query::Type{t}); }
   auto &whereNotType(const EntityType &t) {
-    return add_mod(new Not(new WhereType(t)));
+    return add_pred(query::Not<query::Type>{{t}});
   }
 
-  template <typename T> struct WhereHasComponent : Modification {
-    virtual bool operator()(const Entity &entity) const override {
-      return entity.has<T>();
-    }
-  };
   template <typename T> auto &whereHasComponent() {
-    return add_mod(new WhereHasComponent<T>());
+    return add_pred(query::HasComponent<T>{});
   }
   template <typename T> auto &whereMissingComponent() {
-    return add_mod(new Not(new WhereHasComponent<T>()));
+    return add_pred(query::Not<query::HasComponent<T>>{});
   }
 
-  struct WhereLambda : Modification {
-    std::function<bool(const Entity &)> filter;
-    explicit WhereLambda(const std::function<bool(const Entity &)> &cb)
-        : filter(cb) {}
-    virtual bool operator()(const Entity &entity) const override {
-      return filter(entity);
-    }
-  };
-  auto &whereLambda(const std::function<bool(const Entity &)> &fn) {
-    return add_mod(new WhereLambda(fn));
+  // `since` is exclusive, the default matches anything written during the
+  // current tick
+  template <typename T>
+  auto &whereChanged(Tick since = ComponentStorage::tick() - 1) {
+    return add_pred(query::Changed<T>{since});
+  }
+  template <typename T>
+  auto &whereAdded(Tick since = ComponentStorage::tick() - 1) {
+    return add_pred(query::Added<T>{since});
+  }
+
+  using Filter = std::function<bool(const Entity &)>;
+  auto &whereLambda(const Filter &fn) {
+    return add_pred(query::Lambda<Filter>{fn});
   }
-  auto &
-  whereLambdaExistsAndTrue(const std::function<bool(const Entity &)> &fn) {
+  auto &whereLambdaExistsAndTrue(const Filter &fn) {
     if (fn)
-      return add_mod(new WhereLambda(fn));
+      return whereLambda(fn);
     return *this;
   }
 
-  struct WhereInRange : Modification {
-    vec2 position;
-    float range;
-    bool should_snap;
-
-    // TODO mess around with the right epsilon here
-    explicit WhereInRange(vec2 pos, float r = 0.01f, bool snap = false)
-        : position(pos), range(r), should_snap(snap) {}
-    virtual bool operator()(const Entity &entity) const override {
-      vec2 pos = entity.get<Transform>().as2();
-      if (should_snap)
-        pos = vec::snap(pos);
-      return vec::distance(position, pos) < range;
-    }
-  };
   auto &whereInRange(vec2 position, float range) {
-    return add_mod(new WhereInRange(position, range));
+    return add_pred(query::InRange{position, range});
   }
   auto &whereNotInRange(vec2 position, float range) {
-    return add_mod(new Not(new WhereInRange(position, range)));
+    return add_pred(query::Not<query::InRange>{{position, range}});
   }
   auto &wherePositionMatches(const Entity &entity) {
     return whereInRange(entity.get<Transform>().as2(), 0.01f);
   }
   auto &whereSnappedPositionMatches(vec2 position) {
     // TODO mess around with the right epsilon here
-    return add_mod(new WhereInRange(position, 0.01f, true));
+    return add_pred(query::InRange{position, 0.01f, true});
   }
   auto &whereSnappedPositionMatches(const Entity &entity) {
     return whereSnappedPositionMatches(entity.get<Transform>().as2());
   }
 
-  struct WhereInFront : Modification {
-    vec2 position;
-    float range;
-
-    explicit WhereInFront(vec2 pos, float r) : position(pos), range(r) {}
-    virtual bool operator()(const Entity &entity) const override {
-      float dist = vec::distance(entity.get<Transform>().as2(), position);
-      if (abs(dist) > range)
-        return false;
-      if (dist < 0)
-        return false;
-      return true;
-    }
-  };
-
   auto &whereInFront(vec2 pos, float range = 1.f) {
-    return add_mod(new WhereInFront(pos, range));
+    return add_pred(query::InFront{pos, range});
   }
 
   auto &whereInFront(const Entity &entity, float range = 1.f) {
     return whereInFront(entity.get<Transform>().as2(), range);
   }
 
-  struct WhereInside : Modification {
-    vec2 min;
-    vec2 max;
-
-    explicit WhereInside(vec2 mn, vec2 mx) : min(mn), max(mx) {}
-
-    virtual bool operator()(const Entity &entity) const override {
-      const auto pos = entity.get<Transform>().as2();
-      if (pos.x > max.x || pos.x < min.x)
-        return false;
-      if (pos.y > max.y || pos.y < min.y)
-        return false;
-      return true;
-    }
-  };
   auto &whereInside(vec2 range_min, vec2 range_max) {
-    return add_mod(new WhereInside(range_min, range_max));
+    return add_pred(query::Inside{range_min, range_max});
+  }
+
+  auto &whereCollides(raylib::Rectangle rect) {
+    return add_pred(query::Collides{rect});
+  }
+  auto &whereCollides(const Entity &entity) {
+    return whereNotID(entity.id).whereCollides(
+        entity.get<Transform>().rect());
   }
 
-  // TODO doesnt work in 2d
-  // struct WhereCollides : Modification {
-  // raylib::BoundingBox bounds;
-  //
-  // explicit WhereCollides(raylib::BoundingBox box) : bounds(box) {}
-  //
-  // virtual bool operator()(const Entity &entity) const override {
-  // return CheckCollisionBoxes(entity.get<Transform>().bounds(), bounds);
-  // }
-  // };
-  // auto &whereCollides(raylib::BoundingBox box) {
-  // return add_mod(new WhereCollides(box));
-  // }
   /////////
   struct UnderlyingOptions {
     bool stop_on_first = false;
   };
 
   [[nodiscard]] bool has_values() const {
-    return !run_query({.stop_on_first = true}).empty();
+    query_stats::Timer timer(site);
+    bool found = false;
+    for_each_match([&](Entity &) { return found = true; });
+    return found;
   }
 
   [[nodiscard]] RefEntities
@@ -204,63 +193,340 @@ struct EntityQuery {
   }
 
   [[nodiscard]] OptEntity gen_first() const {
-    if (has_values())
-      return (gen_with_options({.stop_on_first = true})[0]);
-    return {};
+    const RefEntities results = gen_with_options({.stop_on_first = true});
+    if (results.empty())
+      return {};
+    return results[0];
   }
 
   [[nodiscard]] size_t gen_count() const {
-    if (!ran_query)
-      return values_ignore_cache({}).size();
-    return ents.size();
+    if (ran_query)
+      return ents.size();
+    query_stats::Timer timer(site);
+    size_t count = 0;
+    for_each_match([&](Entity &) { return ++count >= limit; });
+    return count;
   }
 
   [[nodiscard]] std::vector<int> gen_ids() const {
-    const auto results = ran_query ? ents : values_ignore_cache({});
     std::vector<int> ids;
-    for (const Entity &ent : results) {
-      ids.push_back(ent.id);
+    if (order_key) {
+      for (const Entity &ent : gen())
+        ids.push_back(ent.id);
+      return ids;
     }
+    for (const Entity &ent : *this)
+      ids.push_back(ent.id);
     return ids;
   }
 
-  EntityQuery() : entities(EntityHelper::get_entities()) {}
-  explicit EntityQuery(const Entities &ents) : entities(ents) {
-    entities = ents;
+  // Lazy iteration over the matches, filters run as you advance and nothing
+  // is collected, so breaking out early stops the scan:
+  //
+  //   EntityQuery cards;
+  //   cards.whereType(EntityType::Card);
+  //   for (Entity &card : cards) {}
+  //
+  // Keep the query in a variable, the builder calls return a reference so
+  // looping straight over `EntityQuery().whereType(..)` would walk a query
+  // that was already destroyed. Ordered queries need every match before the
+  // first one is known, use gen() for those.
+  //
+  // The iterator walks whatever source() picked without copying it: a pool's
+  // owners, the entity list, or the grid / tree candidates kept inside the
+  // query. So while looping:
+  // - dont create or destroy entities, or add or remove components. Record
+  //   those in a CommandBuffer (a system's `commands`) and apply them after
+  //   the loop, or collect the matches with gen() first
+  // - dont start a second loop over the same query, it would refill the
+  //   candidates the first one is walking
+  struct iterator {
+    using iterator_category = std::input_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = Entity;
+    using pointer = Entity *;
+    using reference = Entity &;
+
+    const EntityQuery *query = nullptr;
+    ComponentBitSet required;
+    std::span<Entity *const> source;
+    size_t index = 0;
+    size_t taken = 0;
+
+    iterator() {}
+    explicit iterator(const EntityQuery *q)
+        : query(q), required(q->required_components()),
+          source(q->source(required)) {
+      skip();
+    }
+
+    reference operator*() const { return *source[index]; }
+    pointer operator->() const { return source[index]; }
+
+    iterator &operator++() {
+      index++;
+      taken++;
+      skip();
+      return *this;
+    }
+    void operator++(int) { ++(*this); }
+
+    bool operator==(std::default_sentinel_t) const {
+      return index >= source.size() || taken >= query->limit;
+    }
+
+  private:
+    void skip() {
+      query_stats::Counts counts;
+      while (index < source.size() &&
+             (!source[index] ||
+              !query->passes(*source[index], required, counts)))
+        index++;
+      counts.flush(query->site);
+    }
+  };
+
+  [[nodiscard]] iterator begin() const {
+    VALIDATE(!order_key, "ordered queries have to be collected with gen()");
+    // iteration is lazy so only the call is counted, not its time
+    { query_stats::Timer count_call(site); }
+    return iterator(this);
   }
+  [[nodiscard]] std::default_sentinel_t end() const { return {}; }
+
+  // Runs over a caller provided subset, it is not copied so it has to
+  // outlive the query
+#ifdef ENTITY_QUERY_STATS
+  explicit EntityQuery(
+      std::source_location loc = std::source_location::current())
+      : from_world(true), site(query_stats::site_for(loc)) {}
+  explicit EntityQuery(
+      std::span<Entity *const> ents,
+      std::source_location loc = std::source_location::current())
+      : entities(ents), site(query_stats::site_for(loc)) {}
+#else
+  EntityQuery() : from_world(true) {}
+  explicit EntityQuery(std::span<Entity *const> ents) : entities(ents) {}
+#endif
 
 private:
-  Entities entities;
+  // World queries read the live entity list (or a component pool) at run
+  // time instead of taking a copy up front
+  bool from_world = false;
+  std::span<Entity *const> entities;
 
   std::vector<std::unique_ptr<Modification>> mods;
+  size_t limit = std::numeric_limits<size_t>::max();
+  OrderKey order_key;
+  // 0 means run on the calling thread
+  size_t parallel_chunk = 0;
+  // where this query was built, only set with ENTITY_QUERY_STATS
+  query_stats::Site *site = nullptr;
+  // filled from the spatial indices by source(), reused between runs
+  mutable Entities candidates;
   mutable RefEntities ents;
   mutable bool ran_query = false;
 
+  // Kept sorted by cost so cheap checks reject an entity before the
+  // expensive ones run, filters of the same cost stay in the order they were
+  // added. Every filter has to pass anyway so the results dont change
   EntityQuery &add_mod(Modification *mod) {
-    mods.push_back(std::unique_ptr<Modification>(mod));
+    const auto pos = std::upper_bound(
+        mods.begin(), mods.end(), mod->cost(),
+        [](query::Cost cost, const std::unique_ptr<Modification> &other) {
+          return cost < other->cost();
+        });
+    mods.insert(pos, std::unique_ptr<Modification>(mod));
     return *this;
   }
 
+  template <typename P> EntityQuery &add_pred(P pred) {
+    return add_mod(new Where<P>(std::move(pred)));
+  }
+
+  [[nodiscard]] ComponentBitSet required_components() const {
+    ComponentBitSet required;
+    for (const auto &mod : mods)
+      required |= mod->required();
+    return required;
+  }
+
+  // What a query walks. For world queries that is the AABBTree matches of a
+  // rect filter, or the spatial grid cells when a positional filter narrows
+  // things down enough, otherwise the smallest required pool
+  [[nodiscard]] std::span<Entity *const>
+  source(const ComponentBitSet &required) const {
+    if (!from_world)
+      return entities;
+
+    std::span<Entity *const> fallback = EntityHelper::get_entities();
+    if (required.any()) {
+      const BaseComponentPool *pool = ComponentStorage::smallest(required);
+      if (!pool)
+        return {};
+      fallback = pool->owners;
+    }
+
+    for (const auto &mod : mods) {
+      if (const std::optional<raylib::Rectangle> area = mod->overlap_area()) {
+        query::tree_candidates(*area, candidates);
+        return candidates;
+      }
+    }
+
+    std::optional<query::Box> box;
+    for (const auto &mod : mods)
+      box = query::intersect(box, mod->bounds());
+    if (box && query::grid_candidates(*box, fallback.size(), candidates))
+      return candidates;
+    return fallback;
+  }
+
+  [[nodiscard]] bool passes(Entity &e, const ComponentBitSet &required,
+                            query_stats::Counts &counts) const {
+    counts.scan();
+    if ((e.componentSet & required) != required)
+      return false;
+    for (const std::unique_ptr<Modification> &mod : mods) {
+      counts.predicate();
+      if (!(*mod)(e))
+        return false;
+    }
+    counts.match();
+    return true;
+  }
+
+  // Calls visit(entity) for every match, stops once it returns true
+  template <typename Visit> void for_each_match(Visit &&visit) const {
+    const ComponentBitSet required = required_components();
+    query_stats::Counts counts;
+    for (Entity *e : source(required)) {
+      if (!e)
+        continue;
+      if (passes(*e, required, counts) && visit(*e))
+        break;
+    }
+    counts.flush(site);
+  }
+
   [[nodiscard]] RefEntities run_query(UnderlyingOptions options) const {
+    query_stats::Timer timer(site);
+    const size_t wanted = options.stop_on_first ? std::min<size_t>(limit, 1)
+                                                : limit;
     RefEntities out;
-    for (const auto &e_ptr : entities) {
-      if (!e_ptr)
-        continue;
-      Entity &e = *e_ptr;
+    if (wanted == 0)
+      return out;
+
+    if (parallel_chunk > 0) {
+      const ComponentBitSet required = required_components();
+      const std::span<Entity *const> all = source(required);
+      if (all.size() >= parallel_chunk * 2)
+        return run_query_parallel(all, required, wanted);
+    }
 
-      bool passed_all_mods =
-          std::all_of(mods.begin(), mods.end(),
-                      [&](const std::unique_ptr<Modification> &mod) -> bool {
-                        return (*mod)(e);
-                      });
+    if (!order_key) {
+      for_each_match([&](Entity &e) {
+        out.push_back(e);
+        return out.size() >= wanted;
+      });
+      // TODO turn off cache for now
+      // ran_query = true;
+      return out;
+    }
 
-      if (passed_all_mods)
+    // Only one is wanted, no need for a heap
+    if (wanted == 1) {
+      float best_key = std::numeric_limits<float>::max();
+      Entity *best = nullptr;
+      for_each_match([&](Entity &e) {
+        float key = order_key(e);
+        if (!best || key < best_key) {
+          best = &e;
+          best_key = key;
+        }
+        return false;
+      });
+      if (best)
+        out.push_back(*best);
+      return out;
+    }
+
+    query::BestK best(wanted);
+    for_each_match([&](Entity &e) {
+      best.offer(order_key(e), e);
+      return false;
+    });
+    return best.sorted();
+  }
+
+  [[nodiscard]] RefEntities
+  run_query_parallel(std::span<Entity *const> all,
+                     const ComponentBitSet &required, size_t wanted) const {
+    const size_t num_chunks = (all.size() + parallel_chunk - 1) /
+                              parallel_chunk;
+    const auto chunk_of = [&](size_t chunk) {
+      return all.subspan(chunk * parallel_chunk,
+                         std::min(parallel_chunk,
+                                  all.size() - chunk * parallel_chunk));
+    };
+
+    if (order_key) {
+      // every chunk keeps its own best `wanted`, the overall best are among
+      // those. Each is offered with its index in `all` so ties break the
+      // same way they do in a serial scan
+      std::vector<query::BestK> best(num_chunks, query::BestK(wanted));
+      ThreadPool::get().parallel_for(num_chunks, [&](size_t chunk) {
+        query_stats::Counts counts;
+        const size_t start = chunk * parallel_chunk;
+        const std::span<Entity *const> part = chunk_of(chunk);
+        for (size_t i = 0; i < part.size(); i++) {
+          Entity *e = part[i];
+          if (e && passes(*e, required, counts))
+            best[chunk].offer(order_key(*e), start + i, *e);
+        }
+        counts.flush(site);
+      });
+      query::BestK merged(wanted);
+      for (const query::BestK &part : best) {
+        for (const query::BestK::Scored &scored : part.heap)
+          merged.offer(scored.key, scored.order, *scored.entity);
+      }
+      return merged.sorted();
+    }
+
+    // Matches are stitched back together in chunk order, so the first
+    // `wanted` are the same ones a serial run finds. Once a chunk found
+    // `wanted` on its own nothing after it can make the cut
+    std::vector<RefEntities> found(num_chunks);
+    std::atomic<size_t> satisfied = num_chunks;
+    ThreadPool::get().parallel_for(num_chunks, [&](size_t chunk) {
+      RefEntities &part = found[chunk];
+      query_stats::Counts counts;
+      for (Entity *e : chunk_of(chunk)) {
+        if (chunk > satisfied.load(std::memory_order_relaxed))
+          break;
+        if (!e || !passes(*e, required, counts))
+          continue;
+        part.push_back(*e);
+        if (part.size() < wanted)
+          continue;
+        size_t current = satisfied.load();
+        while (chunk < current &&
+               !satisfied.compare_exchange_weak(current, chunk)) {
+        }
+        break;
+      }
+      counts.flush(site);
+    });
+
+    RefEntities out;
+    for (const RefEntities &part : found) {
+      for (const RefEntity &e : part) {
+        if (out.size() >= wanted)
+          return out;
         out.push_back(e);
-      if (options.stop_on_first && !out.empty())
-        return out;
+      }
     }
-    // TODO turn off cache for now
-    // ran_query = true;
     return out;
   }
 };
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "components/is_slot.h"
+#include "components/transform.h"
+#include "entity.h"
+
+// Every empty IsSlot bucketed by position, answers "closest empty slot to
+// here" by looking at the cells around the point in growing rings instead
+// of at every slot.
+//
+// Same bookkeeping as SpatialGrid: adds and removes come from listening to
+// the IsSlot and Transform pools. Filling or emptying a slot writes its
+// IsSlot (held_entity) and moving it writes its Transform, sync() picks both
+// up from the pools' write logs.
+struct FreeSlotIndex : PoolListener {
+  static constexpr float CELL_SIZE = 256.f;
+
+  [[nodiscard]] static FreeSlotIndex &get() {
+    static FreeSlotIndex index;
+    return index;
+  }
+
+  FreeSlotIndex(const FreeSlotIndex &) = delete;
+  FreeSlotIndex &operator=(const FreeSlotIndex &) = delete;
+
+  ~FreeSlotIndex() {
+    for (ComponentID cid : {components::get_type_id<Transform>(),
+                            components::get_type_id<IsSlot>()}) {
+      if (BaseComponentPool *pool = ComponentStorage::pools[cid])
+        pool->unlisten(this);
+    }
+  }
+
+  void sync() {
+    ComponentPool<IsSlot> &slots = ComponentStorage::get<IsSlot>();
+    for (int slot : slots.take_written(slot_log)) {
+      const int row = slots.index_of(slot);
+      if (row != -1)
+        refresh(*slots.owners[row]);
+    }
+
+    ComponentPool<Transform> &transforms = ComponentStorage::get<Transform>();
+    for (int slot : transforms.take_written(transform_log)) {
+      if (slot >= static_cast<int>(locations.size()) ||
+          locations[slot].index == -1)
+        continue;
+      refresh(*cells[locations[slot].cell][locations[slot].index].entity);
+    }
+  }
+
+  [[nodiscard]] size_t size() const { return num_free; }
+
+  // Closest empty slot that is less than `range` away, the first one found
+  // on ties
+  [[nodiscard]] OptEntity nearest(vec2 position, float range) const {
+    if (num_free == 0 || !(range > 0))
+      return {};
+    const auto [cx, cy] = coords(position);
+    // past this ring every cell is out of range or there are none left
+    const int64_t to_edge =
+        std::max({std::abs(cx - min_x), std::abs(max_x - cx),
+                  std::abs(cy - min_y), std::abs(max_y - cy)});
+    const int64_t last_ring = static_cast<int64_t>(std::min(
+        std::ceil(static_cast<double>(range) / CELL_SIZE),
+        static_cast<double>(to_edge)));
+
+    float best_sq = range * range;
+    const Entry *best = nullptr;
+    const auto visit = [&](int64_t x, int64_t y) {
+      auto it = cells.find(key(x, y));
+      if (it == cells.end())
+        return;
+      for (const Entry &entry : it->second) {
+        const float d = vec::distance_sq(position, entry.position);
+        if (d < best_sq) {
+          best_sq = d;
+          best = &entry;
+        }
+      }
+    };
+
+    for (int64_t ring = 0; ring <= last_ring; ring++) {
+      // cells in this ring are at least (ring - 1) cells away
+      const float reach = static_cast<float>(ring - 1) * CELL_SIZE;
+      if (best && ring > 0 && reach * reach >= best_sq)
+        break;
+      if (ring == 0) {
+        visit(cx, cy);
+        continue;
+      }
+      for (int64_t d = -ring; d <= ring; d++) {
+        visit(cx + d, cy - ring);
+        visit(cx + d, cy + ring);
+      }
+      for (int64_t d = -ring + 1; d <= ring - 1; d++) {
+        visit(cx - ring, cy + d);
+        visit(cx + ring, cy + d);
+      }
+    }
+    if (!best)
+      return {};
+    return *best->entity;
+  }
+
+  virtual void on_added(Entity &entity) override { refresh(entity); }
+
+  // Called before the IsSlot or Transform goes away, without either it is
+  // not a free slot anymore
+  virtual void on_removed(Entity &entity) override { erase(entity); }
+
+private:
+  struct Entry {
+    Entity *entity;
+    vec2 position;
+  };
+
+  struct Location {
+    int64_t cell = 0;
+    // position inside that cell, -1 when not in the index
+    int index = -1;
+  };
+
+  std::unordered_map<int64_t, std::vector<Entry>> cells;
+  // by entity slot
+  std::vector<Location> locations;
+  size_t num_free = 0;
+  // cells that have had a slot in them, only ever grows
+  int64_t min_x = 0;
+  int64_t max_x = 0;
+  int64_t min_y = 0;
+  int64_t max_y = 0;
+  size_t slot_log = 0;
+  size_t transform_log = 0;
+
+  FreeSlotIndex() {
+    ComponentPool<IsSlot> &slots = ComponentStorage::get<IsSlot>();
+    ComponentPool<Transform> &transforms = ComponentStorage::get<Transform>();
+    // anything written before now is covered by the initial fill
+    slot_log = slots.track_writes();
+    transform_log = transforms.track_writes();
+    for (Entity *owner : slots.owners)
+      refresh(*owner);
+    slots.listen(this);
+    transforms.listen(this);
+  }
+
+  // clamped like SpatialGrid so NaN or far away slots still land in a cell
+  [[nodiscard]] static std::pair<int64_t, int64_t> coords(vec2 position) {
+    return {vec::cell_of(position.x, CELL_SIZE),
+            vec::cell_of(position.y, CELL_SIZE)};
+  }
+
+  [[nodiscard]] static int64_t key(int64_t x, int64_t y) {
+    return (x << 32) ^ (y & 0xffffffff);
+  }
+
+  // Puts the entity where it belongs: in the right cell if it is an empty
+  // slot with a position, out of the index otherwise
+  void refresh(Entity &entity) {
+    if (!entity.has<IsSlot>() || !entity.has<Transform>() ||
+        !std::as_const(entity).get<IsSlot>().is_empty()) {
+      erase(entity);
+      return;
+    }
+    const vec2 position = std::as_const(entity).get<Transform>().as2();
+    const auto [x, y] = coords(position);
+    const int slot = entity.handle.index;
+    if (slot < static_cast<int>(locations.size()) &&
+        locations[slot].index != -1) {
+      if (locations[slot].cell == key(x, y)) {
+        cells[key(x, y)][locations[slot].index].position = position;
+        return;
+      }
+      erase(entity);
+    }
+    insert(entity, position, x, y);
+  }
+
+  void insert(Entity &entity, vec2 position, int64_t x, int64_t y) {
+    const int slot = entity.handle.index;
+    if (slot >= static_cast<int>(locations.size()))
+      locations.resize(slot + 1);
+    if (num_free == 0 && cells.empty()) {
+      min_x = max_x = x;
+      min_y = max_y = y;
+    }
+    min_x = std::min(min_x, x);
+    max_x = std::max(max_x, x);
+    min_y = std::min(min_y, y);
+    max_y = std::max(max_y, y);
+
+    std::vector<Entry> &bucket = cells[key(x, y)];
+    locations[slot] = {key(x, y), static_cast<int>(bucket.size())};
+    bucket.push_back({&entity, position});
+    num_free++;
+  }
+
+  void erase(Entity &entity) {
+    const int slot = entity.handle.index;
+    if (slot >= static_cast<int>(locations.size()))
+      return;
+    Location &loc = locations[slot];
+    if (loc.index == -1)
+      return;
+    std::vector<Entry> &bucket = cells[loc.cell];
+    const Entry last = bucket.back();
+    bucket[loc.index] = last;
+    locations[last.entity->handle.index].index = loc.index;
+    bucket.pop_back();
+    if (bucket.empty())
+      cells.erase(loc.cell);
+    loc.index = -1;
+    num_free--;
+  }
+};
@@ -9,9 +9,11 @@
 #include "components/transform.h"
 #include "entity.h"
 #include "entity_helper.h"
+#include "prefab.h"
 
 //
 #include "system/system.h"
+#include "tests/all_tests.h"
 
 int LOG_LEVEL = (int)LogLevel::INFO;
 
@@ -28,40 +30,70 @@ float get_initial_z(EntityType type) {
   }
 }
 
-void make_entity(Entity &entity, vec2 pos, vec2 size) {
-  entity.addComponent<Transform>().init(pos, size, get_initial_z(entity.type));
-  entity.addComponent<RenderTags>();
-}
+using BasePrefab = Prefab<Transform, RenderTags>;
+using CardPrefab = Prefab<Transform, RenderTags, IsDraggable, SnapsToSlot>;
+using TraySlotPrefab = Prefab<Transform, RenderTags, IsSlot>;
 
-void make_card(Entity &entity, vec2 pos, vec2 size) {
-  make_entity(entity, pos, size);
-  entity.addComponent<IsDraggable>();
-  entity.addComponent<SnapsToSlot>();
+template <typename P> P make_prefab(EntityType type) {
+  P prefab{.type = type};
+  prefab.template get<Transform>().z_index = get_initial_z(type);
+  return prefab;
 }
 
-void make_tray_slot(Entity &entity, vec2 pos, vec2 size) {
-  make_entity(entity, pos, size);
-  entity.addComponent<IsSlot>();
+namespace prefabs {
+const CardPrefab card = make_prefab<CardPrefab>(EntityType::Card);
+const TraySlotPrefab tray_slot =
+    make_prefab<TraySlotPrefab>(EntityType::TraySlot);
+} // namespace prefabs
+
+// z_index comes from the prefab
+template <typename... Ts>
+Entity &make_entity(const Prefab<Ts...> &prefab, vec2 pos, vec2 size) {
+  Entity &e = EntityHelper::spawn(prefab);
+  Transform &transform = e.get_mut<Transform>();
+  transform.update(pos);
+  transform.size = size;
+  return e;
 }
 
 Entity &make_entity(EntityType etype, vec2 pos, vec2 size) {
-  Entity &e = EntityHelper::createEntity();
-  e.type = etype;
   switch (etype) {
   case EntityType::Unknown:
   case EntityType::x:
   case EntityType::y:
   case EntityType::z:
-    make_entity(e, pos, size);
-    break;
+    return make_entity(make_prefab<BasePrefab>(etype), pos, size);
   case EntityType::Card:
-    make_card(e, pos, size);
-    break;
+    return make_entity(prefabs::card, pos, size);
   case EntityType::TraySlot:
-    make_tray_slot(e, pos, size);
-    break;
+    return make_entity(prefabs::tray_slot, pos, size);
   }
-  return e;
+  log_warn("make_entity: unknown entity type {}, making a plain one",
+           static_cast<int>(etype));
+  return make_entity(make_prefab<BasePrefab>(etype), pos, size);
+}
+
+void make_board() {
+  const std::array<vec2, 3> tray_positions = {{
+      {200, 20},
+      {500, 20},
+      {1000, 20},
+  }};
+  EntityHandle tray;
+  EntityHelper::spawn_n(prefabs::tray_slot, tray_positions.size(),
+                        [&](Entity &entity, size_t i) {
+                          Transform &transform = entity.get_mut<Transform>();
+                          transform.update(tray_positions[i]);
+                          transform.size = {220, 100};
+                          if (i == 0)
+                            tray = entity.handle;
+                        });
+
+  Entity &card = make_entity(EntityType::Card, {200, 200}, {200, 80});
+
+  card.get_mut<SnapsToSlot>().held_by = tray;
+  EntityHelper::getEntityForHandle(tray)->get_mut<IsSlot>().held_entity =
+      card.handle;
 }
 
 using namespace raylib;
@@ -87,7 +119,12 @@ void draw() {
   EndDrawing();
 }
 
-int main(int, char **) {
+int main(int argc, char **argv) {
+  if (argc > 1 && std::string_view(argv[1]) == "--tests") {
+    tests::run_all();
+    return 0;
+  }
+
   // Initialization
   //--------------------------------------------------------------------------------------
   const int screenWidth = 1920;
@@ -102,14 +139,7 @@ int main(int, char **) {
   SetTargetFPS(240); // Set our game to run at 60 frames-per-second
                      //
 
-  Entity &tray = make_entity(EntityType::TraySlot, {200, 20}, {220, 100});
-  Entity &card = make_entity(EntityType::Card, {200, 200}, {200, 80});
-
-  card.get<SnapsToSlot>().held_by = tray.id;
-  tray.get<IsSlot>().held_entity = card.id;
-
-  make_entity(EntityType::TraySlot, {500, 20}, {220, 100});
-  make_entity(EntityType::TraySlot, {1000, 20}, {220, 100});
+  make_board();
 
   // Main game loop
   while (!WindowShouldClose()) // Detect window close button or ESC key
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "components/is_solid.h"
+#include "components/transform.h"
+#include "entity.h"
+
+// Which tiles of the board are blocked, one bit per TILE_SIZE square.
+//
+// An entity blocks every tile its Transform::rect() touches once it has both
+// a Transform and IsSolid. Same bookkeeping as SpatialGrid: adds and removes
+// come from listening to both pools, moves come from the Transform write
+// log when sync() runs, and only the tiles of entities that actually changed
+// are touched. Each tile counts the solids on it so overlapping ones can
+// come and go in any order.
+//
+// The grid only covers the area solids have been in so far and grows when
+// one leaves it, everything outside is walkable. It never grows past
+// MAX_TILES: a solid that would need more than that (say one placed very far
+// from the rest) only blocks the part of it the grid already covers.
+struct OccupancyGrid : PoolListener {
+  static constexpr float TILE_SIZE = 32.f;
+  // dense storage, 4 bytes and a bit per tile
+  static constexpr size_t MAX_TILES = size_t(1) << 22;
+
+  struct Tile {
+    int x = 0;
+    int y = 0;
+
+    bool operator==(const Tile &) const = default;
+  };
+
+  // Inclusive on both ends, empty when max < min
+  struct TileRect {
+    Tile min;
+    Tile max = {-1, -1};
+
+    [[nodiscard]] bool empty() const { return max.x < min.x || max.y < min.y; }
+    bool operator==(const TileRect &) const = default;
+  };
+
+  [[nodiscard]] static OccupancyGrid &get() {
+    static OccupancyGrid grid;
+    return grid;
+  }
+
+  OccupancyGrid(const OccupancyGrid &) = delete;
+  OccupancyGrid &operator=(const OccupancyGrid &) = delete;
+
+  ~OccupancyGrid() {
+    for (ComponentID cid : {components::get_type_id<Transform>(),
+                            components::get_type_id<IsSolid>()}) {
+      if (BaseComponentPool *pool = ComponentStorage::pools[cid])
+        pool->unlisten(this);
+    }
+  }
+
+  // Bumped whenever a tile changes between blocked and free, anything built
+  // from the grid (like a FlowField) compares against it
+  uint64_t version = 0;
+
+  [[nodiscard]] static Tile tile_of(vec2 position) {
+    return {static_cast<int>(vec::cell_of(position.x, TILE_SIZE)),
+            static_cast<int>(vec::cell_of(position.y, TILE_SIZE))};
+  }
+
+  [[nodiscard]] static vec2 center_of(Tile tile) {
+    return {(static_cast<float>(tile.x) + 0.5f) * TILE_SIZE,
+            (static_cast<float>(tile.y) + 0.5f) * TILE_SIZE};
+  }
+
+  // Every tile the rect overlaps, a rect that ends exactly on a tile edge
+  // does not reach into the next one. Nothing for a rect with a NaN in it
+  [[nodiscard]] static TileRect tiles_of(const raylib::Rectangle &rect) {
+    const float x0 = std::min(rect.x, rect.x + rect.width);
+    const float x1 = std::max(rect.x, rect.x + rect.width);
+    const float y0 = std::min(rect.y, rect.y + rect.height);
+    const float y1 = std::max(rect.y, rect.y + rect.height);
+    if (!(x1 > x0) || !(y1 > y0))
+      return {};
+    const auto end = [](float v) {
+      return static_cast<int>(
+          vec::clamp_cell(std::ceil(static_cast<double>(v) / TILE_SIZE)) - 1);
+    };
+    return {{static_cast<int>(vec::cell_of(x0, TILE_SIZE)),
+             static_cast<int>(vec::cell_of(y0, TILE_SIZE))},
+            {end(x1), end(y1)}};
+  }
+
+  // Re-stamps every solid whose Transform was written since the last sync
+  void sync() {
+    ComponentPool<Transform> &pool = ComponentStorage::get<Transform>();
+    for (int slot : pool.take_written(write_log)) {
+      if (slot >= static_cast<int>(stamps.size()) || !stamps[slot].solid ||
+          !pool.contains(slot))
+        continue;
+      const TileRect tiles = tiles_of(std::as_const(pool).get(slot).rect());
+      if (tiles == stamps[slot].tiles)
+        continue;
+      stamp(stamps[slot].applied, -1);
+      stamps[slot].tiles = tiles;
+      stamps[slot].applied = stamp(tiles, 1);
+    }
+  }
+
+  [[nodiscard]] bool is_blocked(Tile tile) const {
+    if (!inside(tile))
+      return false;
+    const size_t index = index_of(tile);
+    return (bits[index / 64] >> (index % 64)) & 1;
+  }
+
+  [[nodiscard]] bool is_walkable(Tile tile) const { return !is_blocked(tile); }
+
+  // The tiles the grid has storage for, empty before the first solid
+  [[nodiscard]] TileRect bounds() const {
+    if (width == 0)
+      return {};
+    return {origin, {origin.x + width - 1, origin.y + height - 1}};
+  }
+
+  virtual void on_added(Entity &entity) override {
+    if (!entity.has<Transform>() || !entity.has<IsSolid>())
+      return;
+    const int slot = entity.handle.index;
+    if (slot >= static_cast<int>(stamps.size()))
+      stamps.resize(slot + 1);
+    if (stamps[slot].solid)
+      return;
+    const TileRect tiles =
+        tiles_of(std::as_const(entity).get<Transform>().rect());
+    stamps[slot] = {tiles, stamp(tiles, 1), true};
+  }
+
+  // Called before either component goes away, both are needed so the entity
+  // stops being solid either way
+  virtual void on_removed(Entity &entity) override {
+    const int slot = entity.handle.index;
+    if (slot >= static_cast<int>(stamps.size()) || !stamps[slot].solid)
+      return;
+    stamp(stamps[slot].applied, -1);
+    stamps[slot] = {};
+  }
+
+private:
+  // What a solid was last stamped with, by entity slot
+  struct Stamp {
+    // the tiles it covers
+    TileRect tiles;
+    // the part of those the grid had room for, what gets unstamped later
+    TileRect applied;
+    bool solid = false;
+  };
+
+  Tile origin;
+  int width = 0;
+  int height = 0;
+  // solids on each tile, and one bit per tile for "more than zero". 32 bits
+  // since every entity could be stacked on the same tile
+  std::vector<uint32_t> counts;
+  std::vector<uint64_t> bits;
+  std::vector<Stamp> stamps;
+  size_t write_log = 0;
+
+  OccupancyGrid() {
+    ComponentPool<Transform> &transforms = ComponentStorage::get<Transform>();
+    ComponentPool<IsSolid> &solids = ComponentStorage::get<IsSolid>();
+    // anything written before now is covered by the initial fill
+    write_log = transforms.track_writes();
+    for (Entity *owner : solids.owners)
+      on_added(*owner);
+    transforms.listen(this);
+    solids.listen(this);
+  }
+
+  [[nodiscard]] bool inside(Tile tile) const {
+    return tile.x >= origin.x && tile.y >= origin.y &&
+           tile.x < origin.x + width && tile.y < origin.y + height;
+  }
+
+  [[nodiscard]] size_t index_of(Tile tile) const {
+    return static_cast<size_t>(tile.y - origin.y) * width +
+           static_cast<size_t>(tile.x - origin.x);
+  }
+
+  // Adds `delta` to every tile of `tiles` the grid has room for, and returns
+  // that part so it can be taken off again later
+  TileRect stamp(const TileRect &requested, int delta) {
+    if (requested.empty())
+      return {};
+    if (delta > 0)
+      grow_to_fit(requested);
+    const TileRect tiles = clip(requested);
+    for (int y = tiles.min.y; y <= tiles.max.y; y++) {
+      for (int x = tiles.min.x; x <= tiles.max.x; x++) {
+        const size_t index = index_of({x, y});
+        const uint32_t before = counts[index];
+        counts[index] = static_cast<uint32_t>(before + delta);
+        // only the 0 <-> 1 edges change walkability
+        if ((before == 0) != (counts[index] == 0)) {
+          bits[index / 64] ^= uint64_t(1) << (index % 64);
+          version++;
+        }
+      }
+    }
+    return tiles;
+  }
+
+  [[nodiscard]] TileRect clip(const TileRect &tiles) const {
+    if (width == 0)
+      return {};
+    return {{std::max(tiles.min.x, origin.x), std::max(tiles.min.y, origin.y)},
+            {std::min(tiles.max.x, origin.x + width - 1),
+             std::min(tiles.max.y, origin.y + height - 1)}};
+  }
+
+  // Reallocates with some slack on every side that needs it, so a solid
+  // drifting off the edge does not copy the grid every frame. The slack is
+  // dropped when it would go past MAX_TILES, and the grid stays as it is when
+  // even the tiles themselves would (stamp() then clips to what is there)
+  void grow_to_fit(const TileRect &tiles) {
+    if (width > 0 && inside(tiles.min) && inside(tiles.max))
+      return;
+
+    // tiles are within +-vec::MAX_CELL, so none of this overflows in 64 bits
+    struct Bounds {
+      int64_t min_x, min_y, max_x, max_y;
+      [[nodiscard]] size_t size() const {
+        return static_cast<size_t>(max_x - min_x + 1) *
+               static_cast<size_t>(max_y - min_y + 1);
+      }
+    };
+    const TileRect old = bounds();
+    Bounds needed{tiles.min.x, tiles.min.y, tiles.max.x, tiles.max.y};
+    if (!old.empty()) {
+      needed = {std::min<int64_t>(old.min.x, tiles.min.x),
+                std::min<int64_t>(old.min.y, tiles.min.y),
+                std::max<int64_t>(old.max.x, tiles.max.x),
+                std::max<int64_t>(old.max.y, tiles.max.y)};
+    }
+    if (needed.size() > MAX_TILES) {
+      log_warn("occupancy grid would need {} tiles, it only goes up to {}",
+               needed.size(), MAX_TILES);
+      if (!old.empty())
+        return;
+      // nothing to keep yet, cover the corner of the rect that fits
+      const auto side =
+          static_cast<int64_t>(std::sqrt(static_cast<double>(MAX_TILES)));
+      needed.max_x = std::min(needed.max_x, needed.min_x + side - 1);
+      needed.max_y = std::min(needed.max_y, needed.min_y + side - 1);
+    }
+
+    Bounds next = needed;
+    if (!old.empty()) {
+      const int64_t slack_x = std::max(16, width / 2);
+      const int64_t slack_y = std::max(16, height / 2);
+      if (tiles.min.x < old.min.x)
+        next.min_x -= slack_x;
+      if (tiles.min.y < old.min.y)
+        next.min_y -= slack_y;
+      if (tiles.max.x > old.max.x)
+        next.max_x += slack_x;
+      if (tiles.max.y > old.max.y)
+        next.max_y += slack_y;
+      if (next.size() > MAX_TILES)
+        next = needed;
+    }
+
+    const Tile next_min{static_cast<int>(next.min_x),
+                        static_cast<int>(next.min_y)};
+    const int next_width = static_cast<int>(next.max_x - next.min_x + 1);
+    const int next_height = static_cast<int>(next.max_y - next.min_y + 1);
+    const size_t num_tiles = next.size();
+    std::vector<uint32_t> next_counts(num_tiles, 0);
+    std::vector<uint64_t> next_bits((num_tiles + 63) / 64, 0);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        const uint32_t count =
+            counts[static_cast<size_t>(y) * width + static_cast<size_t>(x)];
+        if (count == 0)
+          continue;
+        const size_t index =
+            static_cast<size_t>(origin.y + y - next_min.y) * next_width +
+            static_cast<size_t>(origin.x + x - next_min.x);
+        next_counts[index] = count;
+        next_bits[index / 64] |= uint64_t(1) << (index % 64);
+      }
+    }
+    origin = next_min;
+    width = next_width;
+    height = next_height;
+    counts = std::move(next_counts);
+    bits = std::move(next_bits);
+  }
+};
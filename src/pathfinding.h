@@ -0,0 +1,336 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "engine/log.h"
+#include "occupancy_grid.h"
+#include "vec_util.h"
+
+// Routing over the OccupancyGrid, 8 way movement that never cuts the corner
+// of a blocked tile.
+//
+// Pathfinder is A* for one agent to one goal, FlowField is one search out
+// from a goal that any number of agents then read their next step from. Both
+// keep their buffers between runs and reset them with a generation counter
+// instead of clearing, so once warmed up a search allocates nothing. Keep
+// one around (per thread, if searching in parallel) instead of making a new
+// one per call.
+//
+// Searches run inside a window: the grid's bounds plus the start / goal and
+// MARGIN tiles around all of it, so agents can walk around the outside of
+// the blocked area. Everything beyond the grid is open ground anyway.
+namespace pathfinding {
+
+constexpr int MARGIN = 2;
+// refuse to search anything bigger than this many tiles
+constexpr size_t MAX_TILES = size_t(1) << 22;
+
+using Tile = OccupancyGrid::Tile;
+using TileRect = OccupancyGrid::TileRect;
+
+namespace internal {
+
+constexpr float DIAGONAL = 1.41421356f;
+
+// The area a search runs over, tiles are numbered row by row inside it
+struct Window {
+  Tile origin;
+  int width = 0;
+  int height = 0;
+
+  [[nodiscard]] static Window around(const OccupancyGrid &grid,
+                                     std::initializer_list<Tile> tiles) {
+    TileRect area = grid.bounds();
+    for (Tile tile : tiles) {
+      if (area.empty()) {
+        area = {tile, tile};
+        continue;
+      }
+      area.min = {std::min(area.min.x, tile.x), std::min(area.min.y, tile.y)};
+      area.max = {std::max(area.max.x, tile.x), std::max(area.max.y, tile.y)};
+    }
+    return {{area.min.x - MARGIN, area.min.y - MARGIN},
+            area.max.x - area.min.x + 1 + 2 * MARGIN,
+            area.max.y - area.min.y + 1 + 2 * MARGIN};
+  }
+
+  [[nodiscard]] size_t size() const {
+    return static_cast<size_t>(width) * static_cast<size_t>(height);
+  }
+  [[nodiscard]] bool contains(Tile tile) const {
+    return tile.x >= origin.x && tile.y >= origin.y &&
+           tile.x < origin.x + width && tile.y < origin.y + height;
+  }
+  [[nodiscard]] int index_of(Tile tile) const {
+    return (tile.y - origin.y) * width + (tile.x - origin.x);
+  }
+  [[nodiscard]] Tile tile_at(int index) const {
+    return {origin.x + index % width, origin.y + index / width};
+  }
+};
+
+// Per tile scratch shared by both searches, `seen` says whether the rest of
+// a tile's entries belong to the current search
+struct Scratch {
+  std::vector<uint32_t> seen;
+  std::vector<uint32_t> closed;
+  std::vector<float> cost;
+  std::vector<int> link;
+  // (cost, tile) min heap
+  std::vector<std::pair<float, int>> open;
+  uint32_t generation = 0;
+
+  void begin(size_t num_tiles) {
+    if (seen.size() < num_tiles) {
+      seen.resize(num_tiles, 0);
+      closed.resize(num_tiles, 0);
+      cost.resize(num_tiles);
+      link.resize(num_tiles);
+    }
+    open.clear();
+    // after 4 billion searches the stamps could collide, start over
+    if (++generation == 0) {
+      std::fill(seen.begin(), seen.end(), 0);
+      std::fill(closed.begin(), closed.end(), 0);
+      generation = 1;
+    }
+  }
+
+  [[nodiscard]] bool is_seen(int index) const {
+    return seen[index] == generation;
+  }
+  [[nodiscard]] bool is_closed(int index) const {
+    return closed[index] == generation;
+  }
+  void close(int index) { closed[index] = generation; }
+
+  // Records a cheaper way to reach `index`, false if it was not cheaper
+  bool relax(int index, float c, int from) {
+    if (is_seen(index) && cost[index] <= c)
+      return false;
+    seen[index] = generation;
+    cost[index] = c;
+    link[index] = from;
+    return true;
+  }
+
+  void push(float priority, int index) {
+    open.emplace_back(priority, index);
+    std::push_heap(open.begin(), open.end(), std::greater<>());
+  }
+
+  [[nodiscard]] int pop() {
+    std::pop_heap(open.begin(), open.end(), std::greater<>());
+    const int index = open.back().second;
+    open.pop_back();
+    return index;
+  }
+};
+
+// Calls fn(neighbor, step_cost) for every tile one step from `tile` that
+// can be moved to, diagonals only when both tiles beside them are open
+template <typename Fn>
+void for_each_step(const OccupancyGrid &grid, const Window &window, Tile tile,
+                   Fn &&fn) {
+  for (int a = 0; a < 8; a++) {
+    const Tile next = {tile.x + vec::neigh_x[a], tile.y + vec::neigh_y[a]};
+    if (!window.contains(next) || grid.is_blocked(next))
+      continue;
+    const bool diagonal = vec::neigh_x[a] != 0 && vec::neigh_y[a] != 0;
+    if (diagonal && (grid.is_blocked({next.x, tile.y}) ||
+                     grid.is_blocked({tile.x, next.y})))
+      continue;
+    fn(next, diagonal ? DIAGONAL : 1.f);
+  }
+}
+
+// Shortest 8 way distance when nothing is in the way
+[[nodiscard]] inline float octile(Tile a, Tile b) {
+  const float dx = static_cast<float>(std::abs(a.x - b.x));
+  const float dy = static_cast<float>(std::abs(a.y - b.y));
+  return std::max(dx, dy) + (DIAGONAL - 1.f) * std::min(dx, dy);
+}
+
+} // namespace internal
+
+struct Pathfinder {
+  // Fills `out` with the waypoints from `start` to `goal`, the centers of the
+  // tiles in between followed by `goal` itself. Returns false (and leaves
+  // `out` empty) when the goal is blocked or cant be reached. Starting on a
+  // blocked tile is fine, the agent is allowed to walk out of it
+  bool find_path(vec2 start, vec2 goal, std::vector<vec2> &out) {
+    out.clear();
+    OccupancyGrid &grid = OccupancyGrid::get();
+    grid.sync();
+
+    const Tile from = OccupancyGrid::tile_of(start);
+    const Tile to = OccupancyGrid::tile_of(goal);
+    if (grid.is_blocked(to))
+      return false;
+    if (from == to) {
+      out.push_back(goal);
+      return true;
+    }
+
+    const internal::Window window =
+        internal::Window::around(grid, {from, to});
+    if (window.size() > MAX_TILES) {
+      log_warn("path search area of {} tiles is too big", window.size());
+      return false;
+    }
+
+    scratch.begin(window.size());
+    const int start_index = window.index_of(from);
+    const int goal_index = window.index_of(to);
+    scratch.relax(start_index, 0.f, -1);
+    scratch.push(internal::octile(from, to), start_index);
+
+    bool found = false;
+    while (!scratch.open.empty()) {
+      const int index = scratch.pop();
+      // stale entry for a tile that was reached cheaper since
+      if (scratch.is_closed(index))
+        continue;
+      if (index == goal_index) {
+        found = true;
+        break;
+      }
+      scratch.close(index);
+
+      const float cost = scratch.cost[index];
+      internal::for_each_step(
+          grid, window, window.tile_at(index), [&](Tile next, float step) {
+            const int next_index = window.index_of(next);
+            if (scratch.is_closed(next_index) ||
+                !scratch.relax(next_index, cost + step, index))
+              return;
+            scratch.push(cost + step + internal::octile(next, to),
+                         next_index);
+          });
+    }
+    if (!found)
+      return false;
+
+    // walk back from the goal, then flip it around
+    for (int index = scratch.link[goal_index]; index != start_index;
+         index = scratch.link[index])
+      out.push_back(OccupancyGrid::center_of(window.tile_at(index)));
+    std::reverse(out.begin(), out.end());
+    out.push_back(goal);
+    return true;
+  }
+
+private:
+  internal::Scratch scratch;
+};
+
+// Every reachable tile's next step towards one goal, built with a single
+// search out from the goal. Good for lots of agents heading the same way:
+// after update() each of them only does a lookup per step.
+struct FlowField {
+  // Rebuilds if the goal tile or the grid changed since the last call,
+  // returns whether it did
+  bool update(vec2 goal) {
+    OccupancyGrid &grid = OccupancyGrid::get();
+    grid.sync();
+    const Tile to = OccupancyGrid::tile_of(goal);
+    // the grid only grows when a tile gets blocked, which bumps the version
+    if (built && to == goal_tile && grid.version == grid_version)
+      return false;
+    build(grid, to);
+    return true;
+  }
+
+  // Whether `position` is inside the area the last update() searched. Past
+  // it there are no solids, the goal is straight ahead
+  [[nodiscard]] bool covers(vec2 position) const {
+    return built && window.contains(OccupancyGrid::tile_of(position));
+  }
+
+  // Center of the tile to head for next, the goal tile's center once there.
+  // Nothing in two cases, tell them apart with covers():
+  // - outside the covered area: move straight towards the goal until
+  //   covers() is true, nothing is in the way out there
+  // - inside it: the goal cant be reached from here
+  [[nodiscard]] std::optional<vec2> next_step(vec2 position) const {
+    if (!covers(position))
+      return std::nullopt;
+    const Tile tile = OccupancyGrid::tile_of(position);
+    const int next = next_tile[window.index_of(tile)];
+    if (next == UNREACHABLE)
+      return std::nullopt;
+    return OccupancyGrid::center_of(window.tile_at(next));
+  }
+
+  // Path cost from `position` to the goal in tiles, nothing if unreachable
+  // or not covered
+  [[nodiscard]] std::optional<float> distance(vec2 position) const {
+    if (!covers(position))
+      return std::nullopt;
+    const Tile tile = OccupancyGrid::tile_of(position);
+    const int index = window.index_of(tile);
+    if (next_tile[index] == UNREACHABLE)
+      return std::nullopt;
+    return scratch.cost[index];
+  }
+
+private:
+  static constexpr int UNREACHABLE = -1;
+
+  internal::Scratch scratch;
+  internal::Window window;
+  // by window index, the neighbor to move to
+  std::vector<int> next_tile;
+  Tile goal_tile;
+  uint64_t grid_version = 0;
+  bool built = false;
+
+  void build(const OccupancyGrid &grid, Tile to) {
+    built = true;
+    goal_tile = to;
+    grid_version = grid.version;
+    window = internal::Window::around(grid, {to});
+    if (window.size() > MAX_TILES) {
+      log_warn("flow field area of {} tiles is too big", window.size());
+      window = {};
+      next_tile.clear();
+      return;
+    }
+    next_tile.assign(window.size(), UNREACHABLE);
+    if (grid.is_blocked(to))
+      return;
+
+    // Dijkstra outwards from the goal. Moves are symmetric so the tile a
+    // search reached a tile from is that tile's next step towards the goal
+    scratch.begin(window.size());
+    const int goal_index = window.index_of(to);
+    scratch.relax(goal_index, 0.f, goal_index);
+    scratch.push(0.f, goal_index);
+    while (!scratch.open.empty()) {
+      const int index = scratch.pop();
+      if (scratch.is_closed(index))
+        continue;
+      scratch.close(index);
+      next_tile[index] = scratch.link[index];
+
+      const float cost = scratch.cost[index];
+      internal::for_each_step(
+          grid, window, window.tile_at(index), [&](Tile next, float step) {
+            const int next_index = window.index_of(next);
+            if (scratch.is_closed(next_index) ||
+                !scratch.relax(next_index, cost + step, index))
+              return;
+            scratch.push(cost + step, next_index);
+          });
+    }
+  }
+};
+
+} // namespace pathfinding
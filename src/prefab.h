@@ -0,0 +1,20 @@
+#pragma once
+
+#include <tuple>
+
+#include "entity_type.h"
+
+// Template for spawning entities: an EntityType plus the default value of
+// every component the entity should start with.
+//
+// Spawning copies the defaults straight into the component pools, see
+// EntityHelper::spawn / spawn_n.
+template <typename... Ts> struct Prefab {
+  EntityType type = EntityType::Unknown;
+  std::tuple<Ts...> defaults;
+
+  template <typename T> [[nodiscard]] T &get() { return std::get<T>(defaults); }
+  template <typename T> [[nodiscard]] const T &get() const {
+    return std::get<T>(defaults);
+  }
+};
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <vector>
+
+#include "aabb_tree.h"
+#include "components/render_tag.h"
+#include "components/transform.h"
+#include "entity.h"
+#include "spatial_grid.h"
+#include "vec_util.h"
+
+// Filters shared by EntityQuery and StaticQuery.
+//
+// Each one is a plain value type with `bool operator()(const Entity &) const`
+// so StaticQuery can inline them into its loop. A filter that can only pass
+// for entities with certain components lists them in `required`, the query
+// uses that to walk the smallest of those pools instead of every entity.
+// Components whose values (or presence) change the result are listed in
+// `reads`, CachedQuery rebuilds when one of those is written. Positional
+// filters also give the box every match has to be in through `bounds()`, so
+// world queries can walk the SpatialGrid cells there instead of everything.
+// Rect filters give `overlap_area()` instead and walk the AABBTree.
+//
+// `cost` is a rough tier used to run cheap and selective checks before
+// expensive ones, queries evaluate filters tier by tier (keeping the order
+// they were added in within a tier). Anything that doesnt say is treated as
+// the most expensive.
+namespace query {
+
+enum struct Cost {
+  // bitset compare, already done by the query when it is `required`
+  Mask,
+  // a field directly on the Entity
+  Field,
+  // looks up a component row
+  Component,
+  // looks up the Transform and does some math on it
+  Position,
+  // arbitrary user code
+  Lambda,
+};
+
+template <typename P> [[nodiscard]] ComponentBitSet required_of() {
+  if constexpr (requires { P::required; }) {
+    return P::required;
+  } else {
+    return {};
+  }
+}
+
+template <typename P> [[nodiscard]] ComponentBitSet reads_of() {
+  if constexpr (requires { P::reads; }) {
+    return P::reads;
+  } else {
+    return {};
+  }
+}
+
+using Box = SpatialGrid::Box;
+
+template <typename P>
+[[nodiscard]] std::optional<Box> bounds_of(const P &pred) {
+  if constexpr (requires { pred.bounds(); }) {
+    return pred.bounds();
+  } else {
+    return std::nullopt;
+  }
+}
+
+// Every filter has to pass so the area to look in is the overlap
+[[nodiscard]] inline std::optional<Box> intersect(std::optional<Box> a,
+                                                  std::optional<Box> b) {
+  if (!a)
+    return b;
+  if (!b)
+    return a;
+  return Box{{std::max(a->min.x, b->min.x), std::max(a->min.y, b->min.y)},
+             {std::min(a->max.x, b->max.x), std::min(a->max.y, b->max.y)}};
+}
+
+// Fills `out` with the grid's candidates inside `box` and returns true,
+// unless the box covers so many cells that walking the `fallback_size`
+// entities the query would otherwise look at is cheaper. A box with a NaN
+// in it is left to the scan, the filter knows what it means
+[[nodiscard]] inline bool grid_candidates(const Box &box,
+                                          size_t fallback_size,
+                                          std::vector<Entity *> &out) {
+  out.clear();
+  if (std::isnan(box.min.x) || std::isnan(box.min.y) ||
+      std::isnan(box.max.x) || std::isnan(box.max.y))
+    return false;
+  if (box.min.x > box.max.x || box.min.y > box.max.y)
+    return true;
+  SpatialGrid &grid = SpatialGrid::get();
+  if (grid.num_cells(box) > fallback_size / 2)
+    return false;
+  grid.sync();
+  grid.for_each_in(box, [&](Entity &entity) { out.push_back(&entity); });
+  return true;
+}
+
+template <typename P>
+[[nodiscard]] std::optional<raylib::Rectangle> overlap_area_of(const P &pred) {
+  if constexpr (requires { pred.overlap_area(); }) {
+    return pred.overlap_area();
+  } else {
+    return std::nullopt;
+  }
+}
+
+// Fills `out` with everything whose rect overlaps `area`. The tree is exact
+// and never worse than a scan so there is nothing to decide here
+inline void tree_candidates(const raylib::Rectangle &area,
+                            std::vector<Entity *> &out) {
+  out.clear();
+  AABBTree &tree = AABBTree::get();
+  tree.sync();
+  tree.for_each_overlapping(area,
+                            [&](Entity &entity) { out.push_back(&entity); });
+}
+
+template <typename P> [[nodiscard]] constexpr Cost cost_of() {
+  if constexpr (requires { P::cost; }) {
+    return P::cost;
+  } else {
+    return Cost::Lambda;
+  }
+}
+
+template <typename P> struct Not {
+  static constexpr Cost cost = cost_of<P>();
+  static inline const ComponentBitSet reads = required_of<P>() | reads_of<P>();
+  P pred;
+  [[nodiscard]] bool operator()(const Entity &entity) const {
+    return !pred(entity);
+  }
+};
+
+struct ID {
+  static constexpr Cost cost = Cost::Field;
+  int id;
+  [[nodiscard]] bool operator()(const Entity &entity) const {
+    return entity.id == id;
+  }
+};
+
+struct Type {
+  static constexpr Cost cost = Cost::Field;
+  EntityType type;
+  [[nodiscard]] bool operator()(const Entity &entity) const {
+    return Entity::check_type(entity, type);
+  }
+};
+
+template <typename T> struct HasComponent {
+  static constexpr Cost cost = Cost::Mask;
+  static constexpr ComponentBitSet required = components::mask<T>();
+  [[nodiscard]] bool operator()(const Entity &entity) const {
+    return entity.componentSet[components::get_type_id<T>()];
+  }
+};
+
+struct HasTag {
+  static constexpr ComponentBitSet required = components::mask<RenderTags>();
+  static constexpr ComponentBitSet reads = components::mask<RenderTags>();
+  static constexpr Cost cost = Cost::Component;
+  RenderTagType tag;
+  [[nodiscard]] bool operator()(const Entity &entity) const {
+    return entity.get<RenderTags>().has_tag(tag);
+  }
+};
+
+// `since` is exclusive
+template <typename T> struct Changed {
+  static constexpr ComponentBitSet required = components::mask<T>();
+  static constexpr ComponentBitSet reads = components::mask<T>();
+  static constexpr Cost cost = Cost::Component;
+  Tick since;
+  [[nodiscard]] bool operator()(const Entity &entity) const {
+    return entity.changedSince<T>(since);
+  }
+};
+
+template <typename T> struct Added {
+  static constexpr ComponentBitSet required = components::mask<T>();
+  static constexpr ComponentBitSet reads = components::mask<T>();
+  static constexpr Cost cost = Cost::Component;
+  Tick since;
+  [[nodiscard]] bool operator()(const Entity &entity) const {
+    return entity.addedSince<T>(since);
+  }
+};
+
+template <typename Fn> struct Lambda {
+  static constexpr Cost cost = Cost::Lambda;
+  Fn filter;
+  [[nodiscard]] bool operator()(const Entity &entity) const {
+    return filter(entity);
+  }
+};
+
+struct InRange {
+  static constexpr ComponentBitSet required = components::mask<Transform>();
+  static constexpr ComponentBitSet reads = components::mask<Transform>();
+  static constexpr Cost cost = Cost::Position;
+  vec2 position;
+  // TODO mess around with the right epsilon here
+  float range = 0.01f;
+  bool should_snap = false;
+
+  [[nodiscard]] Box bounds() const {
+    // snapping rounds each axis by up to half a unit
+    const float r = should_snap ? range + 0.5f : range;
+    return {{position.x - r, position.y - r}, {position.x + r, position.y + r}};
+  }
+
+  [[nodiscard]] bool operator()(const Entity &entity) const {
+    vec2 pos = entity.get<Transform>().as2();
+    if (should_snap)
+      pos = vec::snap(pos);
+    // same test as vec::batch::within, no sqrt
+    return range > 0 && vec::distance_sq(position, pos) < range * range;
+  }
+};
+
+struct InFront {
+  static constexpr ComponentBitSet required = components::mask<Transform>();
+  static constexpr ComponentBitSet reads = components::mask<Transform>();
+  static constexpr Cost cost = Cost::Position;
+  vec2 position;
+  float range;
+
+  [[nodiscard]] Box bounds() const {
+    return {{position.x - range, position.y - range},
+            {position.x + range, position.y + range}};
+  }
+
+  [[nodiscard]] bool operator()(const Entity &entity) const {
+    float dist = vec::distance(entity.get<Transform>().as2(), position);
+    if (abs(dist) > range)
+      return false;
+    if (dist < 0)
+      return false;
+    return true;
+  }
+};
+
+struct Inside {
+  static constexpr ComponentBitSet required = components::mask<Transform>();
+  static constexpr ComponentBitSet reads = components::mask<Transform>();
+  static constexpr Cost cost = Cost::Position;
+  vec2 min;
+  vec2 max;
+
+  [[nodiscard]] Box bounds() const { return {min, max}; }
+
+  [[nodiscard]] bool operator()(const Entity &entity) const {
+    const auto pos = entity.get<Transform>().as2();
+    if (pos.x > max.x || pos.x < min.x)
+      return false;
+    if (pos.y > max.y || pos.y < min.y)
+      return false;
+    return true;
+  }
+};
+
+// Transform::rect() overlaps `rect`, same rule as AABBTree so touching edges
+// dont count
+struct Collides {
+  static constexpr ComponentBitSet required = components::mask<Transform>();
+  static constexpr ComponentBitSet reads = components::mask<Transform>();
+  static constexpr Cost cost = Cost::Position;
+  raylib::Rectangle rect;
+
+  [[nodiscard]] raylib::Rectangle overlap_area() const { return rect; }
+
+  [[nodiscard]] bool operator()(const Entity &entity) const {
+    const raylib::Rectangle other = entity.get<Transform>().rect();
+    return other.x < rect.x + rect.width && rect.x < other.x + other.width &&
+           other.y < rect.y + rect.height && rect.y < other.y + other.height;
+  }
+};
+
+// Keeps the `k` entities with the lowest key offered so far in a max heap,
+// so ordering a query is one pass and O(n log k) instead of collecting and
+// sorting everything.
+//
+// Equal keys go by the order they were found in, so ties come out the same
+// however the scan was split up. offer(key, entity) numbers entities as they
+// come, a split scan passes each one's position in the whole scan instead
+struct BestK {
+  struct Scored {
+    float key;
+    size_t order;
+    Entity *entity;
+  };
+
+  size_t k;
+  std::vector<Scored> heap;
+
+  explicit BestK(size_t amount) : k(amount) {}
+
+  void offer(float key, Entity &entity) { offer(key, offered++, entity); }
+
+  void offer(float key, size_t order, Entity &entity) {
+    if (k == 0)
+      return;
+    const Scored scored{key, order, &entity};
+    if (heap.size() < k) {
+      heap.push_back(scored);
+      std::push_heap(heap.begin(), heap.end(), before);
+      return;
+    }
+    if (!before(scored, heap.front()))
+      return;
+    std::pop_heap(heap.begin(), heap.end(), before);
+    heap.back() = scored;
+    std::push_heap(heap.begin(), heap.end(), before);
+  }
+
+  // Lowest key first
+  [[nodiscard]] std::vector<RefEntity> sorted() {
+    std::sort_heap(heap.begin(), heap.end(), before);
+    std::vector<RefEntity> out;
+    out.reserve(heap.size());
+    for (const Scored &scored : heap)
+      out.push_back(*scored.entity);
+    return out;
+  }
+
+private:
+  size_t offered = 0;
+
+  static bool before(const Scored &a, const Scored &b) {
+    if (a.key != b.key)
+      return a.key < b.key;
+    return a.order < b.order;
+  }
+};
+
+} // namespace query
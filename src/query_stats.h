@@ -0,0 +1,173 @@
+#pragma once
+
+// Per call site profiling for EntityQuery and StaticQuery.
+//
+// Build with -DENTITY_QUERY_STATS and every EntityQuery / StaticQuery<>()
+// remembers the source location it was created at. Each run adds to that site's
+// invocation count, entities scanned / matched, filter evaluations and wall
+// time. query_stats::dump() logs every site sorted by total time, or set
+// query_stats::dump_every_n_frames and SystemManager will do it for you.
+//
+// Without the define Counts / Timer are empty and every call on them is an
+// inline no-op, so there is nothing left in the query loops.
+
+#include <cstdint>
+
+#ifdef ENTITY_QUERY_STATS
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <source_location>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "engine/log.h"
+#endif
+
+namespace query_stats {
+
+#ifdef ENTITY_QUERY_STATS
+
+struct Site {
+  std::string_view file;
+  int line = 0;
+  std::string_view function;
+
+  std::atomic<uint64_t> invocations = 0;
+  std::atomic<uint64_t> scanned = 0;
+  std::atomic<uint64_t> matched = 0;
+  std::atomic<uint64_t> predicates = 0;
+  std::atomic<uint64_t> nanoseconds = 0;
+};
+
+namespace internal {
+using Key = std::tuple<std::string_view, int, int>;
+inline std::mutex mutex;
+inline std::map<Key, Site> sites;
+inline int frames_since_dump = 0;
+} // namespace internal
+
+inline int dump_every_n_frames = 0;
+
+[[nodiscard]] inline Site *site_for(const std::source_location &loc) {
+  std::lock_guard<std::mutex> lock(internal::mutex);
+  auto [it, inserted] = internal::sites.try_emplace(
+      {loc.file_name(), static_cast<int>(loc.line()),
+       static_cast<int>(loc.column())});
+  if (inserted) {
+    it->second.file = loc.file_name();
+    it->second.line = static_cast<int>(loc.line());
+    it->second.function = loc.function_name();
+  }
+  return &it->second;
+}
+
+// Tallied locally while scanning and added to the site once at the end so
+// parallel runs dont fight over the same cache line
+struct Counts {
+  uint64_t scanned = 0;
+  uint64_t matched = 0;
+  uint64_t predicates = 0;
+
+  void scan() { scanned++; }
+  void match() { matched++; }
+  void predicate() { predicates++; }
+
+  void flush(Site *site) {
+    if (!site)
+      return;
+    site->scanned += scanned;
+    site->matched += matched;
+    site->predicates += predicates;
+    *this = {};
+  }
+};
+
+// Counts one invocation and its wall time
+struct Timer {
+  Site *site;
+  std::chrono::steady_clock::time_point start;
+
+  explicit Timer(Site *s) : site(s), start(std::chrono::steady_clock::now()) {
+    if (site)
+      site->invocations++;
+  }
+  ~Timer() {
+    if (!site)
+      return;
+    site->nanoseconds += static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+  }
+};
+
+inline void dump() {
+  std::lock_guard<std::mutex> lock(internal::mutex);
+  std::vector<const Site *> sorted;
+  for (const auto &[key, site] : internal::sites)
+    sorted.push_back(&site);
+  std::sort(sorted.begin(), sorted.end(), [](const Site *a, const Site *b) {
+    return a->nanoseconds > b->nanoseconds;
+  });
+
+  log_clean(LogLevel::INFO, "query stats, {} call sites", sorted.size());
+  for (const Site *site : sorted) {
+    const uint64_t calls = std::max<uint64_t>(site->invocations, 1);
+    log_clean(LogLevel::INFO,
+              "{}:{} calls: {} scanned: {} matched: {} predicates: {} "
+              "total: {}us avg: {}us ({})",
+              site->file, site->line, site->invocations.load(),
+              site->scanned.load(), site->matched.load(),
+              site->predicates.load(), site->nanoseconds / 1000,
+              site->nanoseconds / 1000 / calls, site->function);
+  }
+}
+
+// Zeroes every site, queries keep pointing at theirs so they are not removed
+inline void reset() {
+  std::lock_guard<std::mutex> lock(internal::mutex);
+  for (auto &[key, site] : internal::sites) {
+    site.invocations = 0;
+    site.scanned = 0;
+    site.matched = 0;
+    site.predicates = 0;
+    site.nanoseconds = 0;
+  }
+}
+
+// Called once a frame by SystemManager
+inline void on_frame() {
+  if (dump_every_n_frames <= 0)
+    return;
+  if (++internal::frames_since_dump < dump_every_n_frames)
+    return;
+  internal::frames_since_dump = 0;
+  dump();
+}
+
+#else
+
+struct Site;
+
+struct Counts {
+  void scan() {}
+  void match() {}
+  void predicate() {}
+  void flush(Site *) {}
+};
+
+struct Timer {
+  explicit Timer(Site *) {}
+};
+
+inline void dump() {}
+inline void reset() {}
+inline void on_frame() {}
+
+#endif
+
+} // namespace query_stats
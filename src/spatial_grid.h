@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "components/transform.h"
+#include "entity.h"
+
+// Uniform grid over Transform::position so range / box queries only look at
+// the entities in the cells they overlap instead of the whole world.
+//
+// Kept up to date incrementally: it listens to the Transform pool for adds
+// and removes, and the pool records which Transforms were written so sync()
+// only re-buckets those. Queries call sync() before reading it, there is
+// nothing to call by hand.
+//
+// Positions are points, an entity lives in exactly one cell.
+struct SpatialGrid : PoolListener {
+  static constexpr float CELL_SIZE = 128.f;
+
+  struct Box {
+    vec2 min;
+    vec2 max;
+  };
+
+  [[nodiscard]] static SpatialGrid &get() {
+    static SpatialGrid grid;
+    return grid;
+  }
+
+  SpatialGrid(const SpatialGrid &) = delete;
+  SpatialGrid &operator=(const SpatialGrid &) = delete;
+
+  ~SpatialGrid() {
+    if (BaseComponentPool *pool = transforms())
+      pool->unlisten(this);
+  }
+
+  // Moves every entity whose Transform was written since the last sync
+  void sync() {
+    ComponentPool<Transform> &pool = ComponentStorage::get<Transform>();
+    for (int slot : pool.take_written(write_log)) {
+      if (slot >= static_cast<int>(locations.size()))
+        continue;
+      Location &loc = locations[slot];
+      if (loc.index == -1 || !pool.contains(slot))
+        continue;
+      Entity *entity = cells[loc.cell][loc.index];
+      const vec2 position = std::as_const(pool).get(slot).as2();
+      if (cell_for(position) == loc.cell)
+        continue;
+      erase(*entity);
+      insert(*entity, position);
+    }
+  }
+
+  // Cells for_each_in() would look at, saturates instead of wrapping
+  [[nodiscard]] size_t num_cells(const Box &box) const {
+    const CellRange range = cells_in(box);
+    if (range.empty())
+      return 0;
+    const auto width = static_cast<size_t>(range.max_x - range.min_x + 1);
+    const auto height = static_cast<size_t>(range.max_y - range.min_y + 1);
+    if (width > std::numeric_limits<size_t>::max() / height)
+      return std::numeric_limits<size_t>::max();
+    return width * height;
+  }
+
+  // Calls fn(Entity&) for everything in the cells overlapping `box`. These
+  // are candidates, the caller still checks the exact shape. Infinite or
+  // huge boxes are fine, only cells that have had entities are walked
+  template <typename Fn> void for_each_in(const Box &box, Fn &&fn) const {
+    const CellRange range = cells_in(box);
+    for (int64_t x = range.min_x; x <= range.max_x; x++) {
+      for (int64_t y = range.min_y; y <= range.max_y; y++) {
+        auto it = cells.find(key(x, y));
+        if (it == cells.end())
+          continue;
+        for (Entity *entity : it->second)
+          fn(*entity);
+      }
+    }
+  }
+
+  virtual void on_added(Entity &entity) override {
+    insert(entity, std::as_const(entity).get<Transform>().as2());
+  }
+
+  virtual void on_removed(Entity &entity) override { erase(entity); }
+
+private:
+  // Inclusive on both ends, empty when max < min
+  struct CellRange {
+    int64_t min_x = 0;
+    int64_t min_y = 0;
+    int64_t max_x = -1;
+    int64_t max_y = -1;
+
+    [[nodiscard]] bool empty() const { return max_x < min_x || max_y < min_y; }
+  };
+
+  struct Location {
+    int64_t cell = 0;
+    // position inside that cell, -1 when not in the grid
+    int index = -1;
+  };
+
+  std::unordered_map<int64_t, std::vector<Entity *>> cells;
+  // by entity slot
+  std::vector<Location> locations;
+  // cells that have had an entity in them, only ever grows
+  CellRange occupied;
+  size_t write_log = 0;
+
+  SpatialGrid() {
+    ComponentPool<Transform> &pool = ComponentStorage::get<Transform>();
+    // anything written before now is covered by the initial fill
+    write_log = pool.track_writes();
+    for (Entity *owner : pool.owners)
+      on_added(*owner);
+    pool.listen(this);
+  }
+
+  [[nodiscard]] static BaseComponentPool *transforms() {
+    return ComponentStorage::pools[components::get_type_id<Transform>()];
+  }
+
+  [[nodiscard]] static std::pair<int64_t, int64_t> coords(vec2 position) {
+    return {vec::cell_of(position.x, CELL_SIZE),
+            vec::cell_of(position.y, CELL_SIZE)};
+  }
+
+  // The cells overlapping `box`, cut down to the ones that ever had anything
+  // in them. Empty for a box with a NaN in it
+  [[nodiscard]] CellRange cells_in(const Box &box) const {
+    if (occupied.empty() || !(box.min.x <= box.max.x) ||
+        !(box.min.y <= box.max.y))
+      return {};
+    const auto [min_x, min_y] = coords(box.min);
+    const auto [max_x, max_y] = coords(box.max);
+    return {std::max(min_x, occupied.min_x), std::max(min_y, occupied.min_y),
+            std::min(max_x, occupied.max_x), std::min(max_y, occupied.max_y)};
+  }
+
+  [[nodiscard]] static int64_t key(int64_t x, int64_t y) {
+    return (x << 32) ^ (y & 0xffffffff);
+  }
+
+  [[nodiscard]] static int64_t cell_for(vec2 position) {
+    const auto [x, y] = coords(position);
+    return key(x, y);
+  }
+
+  void insert(Entity &entity, vec2 position) {
+    const auto [x, y] = coords(position);
+    if (occupied.empty()) {
+      occupied = {x, y, x, y};
+    } else {
+      occupied.min_x = std::min(occupied.min_x, x);
+      occupied.min_y = std::min(occupied.min_y, y);
+      occupied.max_x = std::max(occupied.max_x, x);
+      occupied.max_y = std::max(occupied.max_y, y);
+    }
+    const int64_t cell = key(x, y);
+    const int slot = entity.handle.index;
+    if (slot >= static_cast<int>(locations.size()))
+      locations.resize(slot + 1);
+    std::vector<Entity *> &bucket = cells[cell];
+    locations[slot] = {cell, static_cast<int>(bucket.size())};
+    bucket.push_back(&entity);
+  }
+
+  void erase(Entity &entity) {
+    const int slot = entity.handle.index;
+    if (slot >= static_cast<int>(locations.size()))
+      return;
+    Location &loc = locations[slot];
+    if (loc.index == -1)
+      return;
+    std::vector<Entity *> &bucket = cells[loc.cell];
+    Entity *last = bucket.back();
+    bucket[loc.index] = last;
+    locations[last->handle.index].index = loc.index;
+    bucket.pop_back();
+    if (bucket.empty())
+      cells.erase(loc.cell);
+    loc.index = -1;
+  }
+};
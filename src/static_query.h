@@ -0,0 +1,325 @@
+#pragma once
+
+#include <limits>
+#include <span>
+#include <tuple>
+
+#include "entity_helper.h"
+#include "query_predicates.h"
+#include "query_stats.h"
+
+// Compile time version of EntityQuery.
+//
+// Every where*() returns a new query type that carries its filters by value,
+// so building one never allocates and running it is a single loop with all
+// of the checks inlined:
+//
+//   auto slots = StaticQuery<>()
+//                    .whereHasComponent<IsSlot>()
+//                    .whereInRange(pos, 100.f)
+//                    .gen();
+//
+// Use EntityQuery when the set of filters is only known at run time.
+//
+// With ENTITY_QUERY_STATS the site is where StaticQuery<>() was written,
+// every query built from it by where*() / take() / from() reports there.
+template <typename... Ps> struct StaticQuery {
+  std::tuple<Ps...> preds;
+  size_t limit = std::numeric_limits<size_t>::max();
+  // Runs over the live world unless from() narrowed it down
+  std::span<Entity *const> subset;
+  bool from_world = true;
+  // where this query was built, only set with ENTITY_QUERY_STATS
+  query_stats::Site *site = nullptr;
+
+#ifdef ENTITY_QUERY_STATS
+  StaticQuery(std::source_location loc = std::source_location::current())
+      : site(query_stats::site_for(loc)) {}
+#else
+  StaticQuery() = default;
+#endif
+
+  template <typename P>
+  [[nodiscard]] StaticQuery<Ps..., P> where(P pred) const {
+    return {std::tuple_cat(preds, std::make_tuple(std::move(pred))), limit,
+            subset, from_world, site};
+  }
+
+  // Only look at `ents`, nothing is copied so they have to outlive the query
+  [[nodiscard]] StaticQuery from(std::span<Entity *const> ents) const {
+    return {preds, limit, ents, false, site};
+  }
+
+  // Keeps the first `amount` found. Same as EntityQuery::take(), unordered
+  // world queries find things in AABBTree / grid cell / pool order rather
+  // than entity list order, use gen_ordered_by() to pick which
+  [[nodiscard]] StaticQuery take(size_t amount) const {
+    return {preds, amount, subset, from_world, site};
+  }
+  [[nodiscard]] StaticQuery first() const { return take(1); }
+
+  [[nodiscard]] auto whereID(int id) const { return where(query::ID{id}); }
+  [[nodiscard]] auto whereNotID(int id) const {
+    return where(query::Not<query::ID>{{id}});
+  }
+
+  [[nodiscard]] auto whereType(EntityType t) const {
+    return where(query::Type{t});
+  }
+  [[nodiscard]] auto whereNotType(EntityType t) const {
+    return where(query::Not<query::Type>{{t}});
+  }
+
+  template <typename T> [[nodiscard]] auto whereHasComponent() const {
+    return where(query::HasComponent<T>{});
+  }
+  template <typename T> [[nodiscard]] auto whereMissingComponent() const {
+    return where(query::Not<query::HasComponent<T>>{});
+  }
+  [[nodiscard]] auto whereHasTag(RenderTagType tag) const {
+    return where(query::HasTag{tag});
+  }
+
+  template <typename T>
+  [[nodiscard]] auto whereChanged(Tick since = ComponentStorage::tick() -
+                                               1) const {
+    return where(query::Changed<T>{since});
+  }
+  template <typename T>
+  [[nodiscard]] auto whereAdded(Tick since = ComponentStorage::tick() -
+                                             1) const {
+    return where(query::Added<T>{since});
+  }
+
+  template <typename Fn> [[nodiscard]] auto whereLambda(Fn fn) const {
+    return where(query::Lambda<Fn>{std::move(fn)});
+  }
+
+  [[nodiscard]] auto whereInRange(vec2 position, float range) const {
+    return where(query::InRange{position, range});
+  }
+  [[nodiscard]] auto whereNotInRange(vec2 position, float range) const {
+    return where(query::Not<query::InRange>{{position, range}});
+  }
+  [[nodiscard]] auto whereSnappedPositionMatches(vec2 position) const {
+    return where(query::InRange{position, 0.01f, true});
+  }
+  [[nodiscard]] auto whereInFront(vec2 position, float range = 1.f) const {
+    return where(query::InFront{position, range});
+  }
+  [[nodiscard]] auto whereInside(vec2 range_min, vec2 range_max) const {
+    return where(query::Inside{range_min, range_max});
+  }
+  [[nodiscard]] auto whereCollides(raylib::Rectangle rect) const {
+    return where(query::Collides{rect});
+  }
+  [[nodiscard]] auto whereCollides(const Entity &entity) const {
+    return whereNotID(entity.id).whereCollides(
+        entity.get<Transform>().rect());
+  }
+
+  // Runs the filters cheapest tier first (see query::Cost), the tiers are
+  // known at compile time so this unrolls into one chain of checks
+  [[nodiscard]] bool matches(const Entity &entity) const {
+    query_stats::Counts counts;
+    return matches(entity, counts);
+  }
+
+  // Calls fn(Entity&) for every match, in the order they are found
+  template <typename Fn> void each(Fn &&fn) const {
+    run([&](Entity &entity) {
+      fn(entity);
+      return false;
+    });
+  }
+
+  [[nodiscard]] RefEntities gen() const {
+    RefEntities out;
+    each([&](Entity &entity) { out.push_back(entity); });
+    return out;
+  }
+
+  [[nodiscard]] OptEntity gen_first() const {
+    OptEntity out;
+    run([&](Entity &entity) {
+      out = entity;
+      return true;
+    });
+    return out;
+  }
+
+  [[nodiscard]] bool has_values() const { return gen_first().valid(); }
+
+  // Matches with the lowest key(entity) first. take() applies after the
+  // ordering, only the best ones are kept while scanning so this is a
+  // single pass and O(n log k)
+  template <typename Key>
+  [[nodiscard]] RefEntities gen_ordered_by(const Key &key) const {
+    query::BestK best(limit);
+    run(
+        [&](Entity &entity) {
+          best.offer(key(std::as_const(entity)), entity);
+          return false;
+        },
+        /* apply_limit */ false);
+    return best.sorted();
+  }
+
+  template <typename Key>
+  [[nodiscard]] OptEntity gen_min_by(const Key &key) const {
+    float best_key = std::numeric_limits<float>::max();
+    Entity *best = nullptr;
+    run(
+        [&](Entity &entity) {
+          float k = key(std::as_const(entity));
+          if (!best || k < best_key) {
+            best = &entity;
+            best_key = k;
+          }
+          return false;
+        },
+        /* apply_limit */ false);
+    if (!best || limit == 0)
+      return {};
+    return *best;
+  }
+
+  [[nodiscard]] RefEntities gen_nearest(vec2 position) const {
+    return gen_ordered_by(distance_to(position));
+  }
+  [[nodiscard]] OptEntity gen_first_nearest(vec2 position) const {
+    return gen_min_by(distance_to(position));
+  }
+
+  [[nodiscard]] size_t gen_count() const {
+    size_t count = 0;
+    each([&](Entity &) { count++; });
+    return count;
+  }
+
+  [[nodiscard]] std::vector<int> gen_ids() const {
+    std::vector<int> ids;
+    each([&](Entity &entity) { ids.push_back(entity.id); });
+    return ids;
+  }
+
+  [[nodiscard]] static ComponentBitSet required() {
+    ComponentBitSet out;
+    ((out |= query::required_of<Ps>()), ...);
+    return out;
+  }
+
+  [[nodiscard]] std::optional<query::Box> bounds() const {
+    return std::apply(
+        [](const Ps &...pred) {
+          std::optional<query::Box> box;
+          ((box = query::intersect(box, query::bounds_of(pred))), ...);
+          return box;
+        },
+        preds);
+  }
+
+  // The first rect filter's area, matches have to overlap it
+  [[nodiscard]] std::optional<raylib::Rectangle> overlap_area() const {
+    return std::apply(
+        [](const Ps &...pred) {
+          std::optional<raylib::Rectangle> area;
+          ((area = area ? area : query::overlap_area_of(pred)), ...);
+          return area;
+        },
+        preds);
+  }
+
+  [[nodiscard]] static ComponentBitSet reads() {
+    ComponentBitSet out;
+    ((out |= query::reads_of<Ps>()), ...);
+    return out;
+  }
+
+private:
+  // Built by where*() / take() / from() of any StaticQuery
+  template <typename...> friend struct StaticQuery;
+
+  StaticQuery(std::tuple<Ps...> p, size_t l, std::span<Entity *const> s,
+              bool world, query_stats::Site *at)
+      : preds(std::move(p)), limit(l), subset(s), from_world(world),
+        site(at) {}
+
+  [[nodiscard]] bool matches(const Entity &entity,
+                             query_stats::Counts &counts) const {
+    return matches_tier<query::Cost::Mask>(entity, counts) &&
+           matches_tier<query::Cost::Field>(entity, counts) &&
+           matches_tier<query::Cost::Component>(entity, counts) &&
+           matches_tier<query::Cost::Position>(entity, counts) &&
+           matches_tier<query::Cost::Lambda>(entity, counts);
+  }
+
+  template <query::Cost tier>
+  [[nodiscard]] bool matches_tier(const Entity &entity,
+                                  query_stats::Counts &counts) const {
+    return std::apply(
+        [&](const Ps &...pred) {
+          return ((query::cost_of<Ps>() != tier ||
+                   (counts.predicate(), pred(entity))) &&
+                  ...);
+        },
+        preds);
+  }
+
+  [[nodiscard]] static auto distance_to(vec2 position) {
+    return [position](const Entity &entity) {
+      return vec::distance(position, entity.get<Transform>().as2());
+    };
+  }
+
+  // visit returns true to stop early, ordered gens skip the limit here and
+  // apply it after ordering
+  template <typename Visit>
+  void run(Visit &&visit, bool apply_limit = true) const {
+    const size_t max =
+        apply_limit ? limit : std::numeric_limits<size_t>::max();
+    if (max == 0)
+      return;
+
+    query_stats::Timer timer(site);
+    query_stats::Counts counts;
+    const ComponentBitSet req = required();
+    size_t taken = 0;
+    const auto check = [&](Entity &entity) -> bool {
+      counts.scan();
+      if ((entity.componentSet & req) != req || !matches(entity, counts))
+        return false;
+      counts.match();
+      return visit(entity) || ++taken >= max;
+    };
+
+    std::span<Entity *const> source = subset;
+    // only filled when one of the spatial indices is used
+    Entities candidates;
+    if (from_world) {
+      source = EntityHelper::get_entities();
+      if (req.any()) {
+        const BaseComponentPool *pool = ComponentStorage::smallest(req);
+        if (!pool)
+          return;
+        source = pool->owners;
+      }
+      if (const std::optional<raylib::Rectangle> area = overlap_area()) {
+        query::tree_candidates(*area, candidates);
+        source = candidates;
+      } else if (const std::optional<query::Box> box = bounds();
+                 box &&
+                 query::grid_candidates(*box, source.size(), candidates)) {
+        source = candidates;
+      }
+    }
+
+    for (Entity *entity : source) {
+      if (!entity)
+        continue;
+      if (check(*entity))
+        break;
+    }
+    counts.flush(site);
+  }
+};
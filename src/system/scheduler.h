@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <span>
+#include <vector>
+
+#include "../components/base_component.h"
+#include "../engine/thread_pool.h"
+
+// What a system touches. Two systems can run at the same time when neither
+// writes a component the other reads or writes.
+//
+// Entity::get_mut<T>() counts as writing T (it stamps the row as changed),
+// so a system that only declares reads has to stick to get<T>().
+struct Access {
+  ComponentBitSet reads;
+  ComponentBitSet writes;
+  // Anything the sets cant describe, like reordering the entity list or
+  // talking to raylib. Runs on its own, on the main thread
+  bool exclusive = false;
+
+  [[nodiscard]] bool conflicts_with(const Access &other) const {
+    if (exclusive || other.exclusive)
+      return true;
+    return (writes & (other.reads | other.writes)).any() ||
+           (other.writes & reads).any();
+  }
+};
+
+// Splits a list of systems into stages that run one after the other, where
+// everything inside a stage runs side by side on the ThreadPool.
+//
+// A system goes into the first stage after every earlier system it
+// conflicts with, so conflicting systems still run in the order they are
+// listed and the rest move up to run alongside whatever they can. The
+// stages are built once, access() is expected not to change.
+template <typename S> struct Schedule {
+  std::vector<std::vector<S *>> stages;
+
+  Schedule() = default;
+
+  explicit Schedule(std::span<S *const> systems) {
+    std::vector<size_t> stage_of(systems.size(), 0);
+    std::vector<Access> access;
+    access.reserve(systems.size());
+    for (size_t i = 0; i < systems.size(); i++) {
+      access.push_back(systems[i]->access());
+      size_t stage = 0;
+      for (size_t j = 0; j < i; j++) {
+        if (access[i].conflicts_with(access[j]))
+          stage = std::max(stage, stage_of[j] + 1);
+      }
+      stage_of[i] = stage;
+      if (stage >= stages.size())
+        stages.resize(stage + 1);
+      stages[stage].push_back(systems[i]);
+    }
+  }
+
+  // A stage at a time: before(S&) for each of its systems in listed order on
+  // the calling thread, then body(S&) for all of them side by side, then
+  // after(S&) in listed order on the calling thread again
+  template <typename Before, typename Body, typename After>
+  void run(const Before &before, const Body &body, const After &after) const {
+    for (const std::vector<S *> &stage : stages) {
+      for (S *system : stage)
+        before(*system);
+      ThreadPool::get().parallel_for(
+          stage.size(), [&](size_t i) { body(*stage[i]); });
+      for (S *system : stage)
+        after(*system);
+    }
+  }
+};
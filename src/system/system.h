@@ -1,6 +1,15 @@
+#pragma once
 
+#include <utility>
+#include <vector>
 
+#include "../aabb_tree.h"
+#include "../cached_query.h"
+#include "../command_buffer.h"
 #include "../entity_helper.h"
+#include "../free_slot_index.h"
+#include "../query_stats.h"
+#include "scheduler.h"
 
 #include "../components/is_draggable.h"
 #include "../components/is_slot.h"
@@ -8,12 +17,23 @@
 #include "../components/snaps_to_slot.h"
 
 struct System {
+  // Creating / destroying entities or adding / removing components while
+  // iterating is not safe, record them here instead. SystemManager applies
+  // them once this system is done running
+  CommandBuffer commands;
+
+  // The components run_on touches, SystemManager runs systems whose access
+  // does not conflict at the same time. Exclusive unless a system says
+  // otherwise, anything that is not exclusive must not call into raylib or
+  // sync() one of the spatial indices (neither is thread safe)
+  [[nodiscard]] virtual Access access() const { return {.exclusive = true}; }
+
   virtual void run_on(Entities &, float){};
   virtual void run_on(const Entities &, float) const {};
 
   void for_each(Entities &entities, float dt,
                 const std::function<void(Entity &, float)> &cb) {
-    std::ranges::for_each(entities, [cb, dt](std::shared_ptr<Entity> entity) {
+    std::ranges::for_each(entities, [cb, dt](Entity *entity) {
       if (!entity)
         return;
       cb(*entity, dt);
@@ -23,7 +43,7 @@ struct System {
   void for_each(const Entities &entities, float dt,
                 const std::function<void(const Entity &, float)> &cb) const {
     std::ranges::for_each(std::as_const(entities),
-                          [cb, dt](std::shared_ptr<Entity> entity) {
+                          [cb, dt](const Entity *entity) {
                             if (!entity)
                               return;
                             cb(*entity, dt);
@@ -39,8 +59,12 @@ struct DraggingSystem : System {
   const int EMPTY_ID = -1;
   const int FAKE_ID = -2;
 
+  static constexpr float SNAP_RANGE = 1920.f;
+
   int active_id = EMPTY_ID;
   int hot_id = FAKE_ID;
+  // the slot showing where the dragged card would land
+  EntityHandle highlighted_slot = EntityHandle::null();
 
   vec2 offset;
   bool mouse_down;
@@ -54,31 +78,60 @@ struct DraggingSystem : System {
   inline bool is_active_or_hot(int id) { return is_hot(id) || is_active(id); }
   inline bool is_active_and_hot(int id) { return is_hot(id) && is_active(id); }
 
-  void determine_active(Entity &entity) {
-    const Transform &transform = entity.get<Transform>();
-    bool inside = ext::is_mouse_inside(transform.rect());
-    if (inside) {
-      set_hot(entity.id);
-      if (is_active(EMPTY_ID) && mouse_down) {
-        set_active(entity.id);
-
-        auto mouse_position = ext::get_mouse_position();
-        offset = mouse_position - entity.get<Transform>().as2();
+  // The topmost draggable under the mouse is hot, and becomes active when
+  // the mouse goes down while nothing else is
+  void determine_active() {
+    const vec2 mouse_position = ext::get_mouse_position();
+    AABBTree &tree = AABBTree::get();
+    tree.sync();
+    OptEntity top = tree.pick(mouse_position, [](const Entity &entity) {
+      return entity.has<IsDraggable>();
+    });
+    if (!top)
+      return;
 
-        entity.get<RenderTags>().enable_tag(RenderTagType::Highlight);
-      }
+    Entity &entity = top.asE();
+    set_hot(entity.id);
+    if (is_active(EMPTY_ID) && mouse_down) {
+      set_active(entity.id);
+      offset = mouse_position - std::as_const(entity).get<Transform>().as2();
+      entity.get_mut<RenderTags>().enable_tag(RenderTagType::Highlight);
     }
   }
 
-  void move_if_dragging(Entity &entity) {
-    if (is_active(entity.id)) {
-      Transform &transform = entity.get<Transform>();
+  void move_if_dragging() {
+    auto maybe_e = EntityHelper::getEntityForID(active_id);
+    if (!maybe_e)
+      return;
 
-      auto mouse_position = ext::get_mouse_position();
+    auto mouse_position = ext::get_mouse_position();
+    maybe_e->get_mut<Transform>().update(
+        {mouse_position.x - offset.x, mouse_position.y - offset.y});
+  }
 
-      transform.update(
-          {mouse_position.x - offset.x, mouse_position.y - offset.y});
+  // Closest slot `entity` could snap into: an empty one, or the one that is
+  // already holding it
+  OptEntity find_snap_target(const Entity &entity) {
+    const vec2 position = entity.get<Transform>().as2();
+    FreeSlotIndex &free_slots = FreeSlotIndex::get();
+    free_slots.sync();
+    OptEntity closest = free_slots.nearest(position, SNAP_RANGE);
+
+    const OptEntity holder =
+        EntityHelper::getEntityForHandle(entity.get<SnapsToSlot>().held_by);
+    if (!holder || holder->is_missing<IsSlot>() ||
+        holder->get<IsSlot>().held_entity != entity.handle)
+      return closest;
+    const float to_holder =
+        vec::distance(position, holder->get<Transform>().as2());
+    if (to_holder >= SNAP_RANGE)
+      return closest;
+    if (closest) {
+      const vec2 at = std::as_const(closest)->get<Transform>().as2();
+      if (vec::distance(position, at) <= to_holder)
+        return closest;
     }
+    return holder;
   }
 
   void snap_if_snappable() {
@@ -89,83 +142,58 @@ struct DraggingSystem : System {
     if (entity.is_missing<SnapsToSlot>())
       return;
 
-    auto closest = EntityHelper::getClosestMatchingEntity(
-        entity.get<Transform>().as2(), 1920.f, [this](const Entity &entity) {
-          if (entity.is_missing<IsSlot>())
-            return false;
-          if (entity.get<IsSlot>().held_entity == active_id)
-            return true;
-          return entity.get<IsSlot>().is_empty();
-        });
+    auto closest = find_snap_target(entity);
     if (!closest) {
       log_warn(" Could not find any empty slot to snap to");
       return;
     }
 
-    SnapsToSlot &snaps = entity.get<SnapsToSlot>();
+    SnapsToSlot &snaps = entity.get_mut<SnapsToSlot>();
 
     // clear old parent
-    auto old_parent = EntityHelper::getEntityForID(snaps.held_by);
-    old_parent->get<IsSlot>().held_entity = -1;
+    auto old_parent = EntityHelper::getEntityForHandle(snaps.held_by);
+    if (old_parent)
+      old_parent->get_mut<IsSlot>().held_entity = EntityHandle::null();
 
     // write new parent
-    closest->get<IsSlot>().held_entity = entity.id;
-    snaps.held_by = closest->id;
-    Transform &parent_transform = closest->get<Transform>();
+    closest->get_mut<IsSlot>().held_entity = entity.handle;
+    snaps.held_by = closest->handle;
+    const Transform &parent_transform =
+        std::as_const(closest.asE()).get<Transform>();
 
-    entity.get<Transform>().update({
+    entity.get_mut<Transform>().update({
         parent_transform.as2().x,
         parent_transform.as2().y,
     });
 
-    entity.get<RenderTags>().disable_tag(RenderTagType::Highlight);
-  }
-
-  void reset_highlighted_slots(Entity &entity, float) {
-    if (entity.is_missing<IsSlot>())
-      return;
-    entity.get<RenderTags>().disable_tag(RenderTagType::Highlight);
+    entity.get_mut<RenderTags>().disable_tag(RenderTagType::Highlight);
   }
 
+  // Once a frame, moves the highlight to wherever the dragged card would
+  // snap (or clears it when nothing is being dragged)
   void highlight_possible_snap_location() {
+    OptEntity target;
     auto maybe_e = EntityHelper::getEntityForID(active_id);
-    if (!maybe_e)
-      return;
-
-    Entity &entity = maybe_e.asE();
-    if (entity.is_missing<SnapsToSlot>())
-      return;
-
-    auto closest = EntityHelper::getClosestMatchingEntity(
-        entity.get<Transform>().as2(), 1920.f, [this](const Entity &entity) {
-          if (entity.is_missing<IsSlot>())
-            return false;
-          if (entity.get<IsSlot>().held_entity == active_id)
-            return true;
-          return entity.get<IsSlot>().is_empty();
-        });
-    if (!closest) {
-      return;
-    }
-    closest->get<RenderTags>().enable_tag(RenderTagType::Highlight);
-  }
+    if (maybe_e && maybe_e->has<SnapsToSlot>())
+      target = find_snap_target(maybe_e.asE());
 
-  void handle_draggable_entity(Entity &entity, float dt) {
-    if (entity.is_missing<IsDraggable>())
+    const EntityHandle next =
+        target ? target->handle : EntityHandle::null();
+    if (next == highlighted_slot)
       return;
-
-    determine_active(entity);
-    move_if_dragging(entity);
+    if (OptEntity old = EntityHelper::getEntityForHandle(highlighted_slot))
+      old->get_mut<RenderTags>().disable_tag(RenderTagType::Highlight);
+    if (target)
+      target->get_mut<RenderTags>().enable_tag(RenderTagType::Highlight);
+    highlighted_slot = next;
   }
 
-  virtual void run_on(Entities &entities, float dt) override {
+  virtual void run_on(Entities &, float) override {
     set_hot(EMPTY_ID);
 
-    for_each(entities, dt, [this](Entity &entity, float dt) {
-      reset_highlighted_slots(entity, dt);
-      highlight_possible_snap_location();
-      handle_draggable_entity(entity, dt);
-    });
+    determine_active();
+    move_if_dragging();
+    highlight_possible_snap_location();
 
     if (mouse_down) {
       if (is_active(EMPTY_ID)) {
@@ -183,52 +211,104 @@ struct DraggingSystem : System {
 };
 
 namespace render {
-inline void rect(const Entity &entity, float, raylib::Color color) {
+// A rectangle to draw, recorded off the main thread and drawn on it
+struct DrawRect {
+  vec2 position;
+  vec2 size;
+  raylib::Color color;
+};
+using DrawList = std::vector<DrawRect>;
+
+inline void rect(DrawList &draws, const Entity &entity, float,
+                 raylib::Color color) {
   const Transform &transform = entity.get<Transform>();
-  ext::draw_rectangle(transform.position, transform.size, color);
+  draws.push_back({transform.position, transform.size, color});
 }
 
 } // namespace render
 
 struct PreRenderingSystem : System {
+  Tick last_sorted = 0;
+
+  // only resort when a Transform was written or entities came / went
   void run_on(Entities &entities, float) {
-    std::sort(entities.begin(), entities.end(),
-              [](const std::shared_ptr<Entity> a,
-                 const std::shared_ptr<Entity> b) -> bool {
-                return a->get<Transform>().z_index <
-                       b->get<Transform>().z_index;
-              });
+    const ComponentPool<Transform> &transforms =
+        ComponentStorage::get<Transform>();
+    if (last_sorted != 0 && !transforms.any_changed_since(last_sorted) &&
+        !transforms.structure_changed_since(last_sorted))
+      return;
+    last_sorted = ComponentStorage::tick();
+
+    // stable so cards on the same z keep their draw order between sorts
+    std::stable_sort(entities.begin(), entities.end(),
+                     [](const Entity *a, const Entity *b) -> bool {
+                       return a->get<Transform>().z_index <
+                              b->get<Transform>().z_index;
+                     });
+    // AABBTree::pick breaks z ties by list position
+    for (size_t i = 0; i < entities.size(); i++)
+      entities[i]->list_index = static_cast<int>(i);
   }
 };
 
-struct HighlightRenderingSystem : System {
-  void run_on(const Entities &entities, float dt) const {
-    for_each(entities, dt, [](const Entity &entity, float) {
-      const RenderTags &tags = entity.get<RenderTags>();
-      if (tags.missing_tag(RenderTagType::Highlight))
-        return;
+// Rendering is split in two: prepare() walks the entities and records what to
+// draw, on a worker thread next to any other render system it does not
+// conflict with, and submit() hands the recorded draws to raylib on the main
+// thread in system order
+struct RenderSystem : System {
+  render::DrawList draws;
 
-      const Transform &transform = entity.get<Transform>();
-      ext::draw_rectangle(transform.position,
-                          {transform.size.x * 1.1f, transform.size.y * 1.1f},
-                          raylib::PINK);
-    });
+  virtual void prepare(const Entities &entities, float dt) = 0;
+
+  void submit() const {
+    for (const render::DrawRect &draw : draws)
+      ext::draw_rectangle(draw.position, draw.size, draw.color);
   }
 };
 
-struct RenderingSystem : System {
-  void run_on(const Entities &entities, float dt) const {
-    for_each(entities, dt, [](const Entity &entity, float dt) {
+struct HighlightRenderingSystem : RenderSystem {
+  // only rebuilt on frames where a RenderTags was written
+  CachedQuery<query::HasComponent<Transform>, query::HasTag> highlighted{
+      StaticQuery<>().whereHasComponent<Transform>().whereHasTag(
+          RenderTagType::Highlight)};
+
+  [[nodiscard]] Access access() const override {
+    return {.reads = components::mask<Transform, RenderTags>()};
+  }
+
+  // any rebuild (or late pool registration) happens here on the main thread,
+  // prepare() then just reads the result
+  void before_first() override { (void)highlighted.get(); }
+
+  void prepare(const Entities &, float) override {
+    draws.clear();
+    for (const Entity *entity : highlighted.get()) {
+      const Transform &transform = entity->get<Transform>();
+      draws.push_back({transform.position,
+                       {transform.size.x * 1.1f, transform.size.y * 1.1f},
+                       raylib::PINK});
+    }
+  }
+};
+
+struct RenderingSystem : RenderSystem {
+  [[nodiscard]] Access access() const override {
+    return {.reads = components::mask<Transform>()};
+  }
+
+  void prepare(const Entities &entities, float dt) override {
+    draws.clear();
+    for_each(std::as_const(entities), dt, [&](const Entity &entity, float dt) {
       switch (entity.type) {
       case EntityType::Unknown:
       case EntityType::x:
       case EntityType::y:
       case EntityType::z:
       case EntityType::Card:
-        render::rect(entity, dt, raylib::RED);
+        render::rect(draws, entity, dt, raylib::RED);
         break;
       case EntityType::TraySlot:
-        render::rect(entity, dt, raylib::BLUE);
+        render::rect(draws, entity, dt, raylib::BLUE);
         break;
       }
     });
@@ -243,28 +323,47 @@ struct SystemManager {
       new PreRenderingSystem(),
   }};
 
-  std::array<System *, 2> render_systems = {{
+  std::array<RenderSystem *, 2> render_systems = {{
       new HighlightRenderingSystem(),
       new RenderingSystem(),
   }};
 
-  SystemManager() {}
+  Schedule<System> update_schedule;
+  Schedule<RenderSystem> render_schedule;
+
+  SystemManager()
+      : update_schedule(update_systems), render_schedule(render_systems) {}
 
   void on_update(Entities &entities, float dt) {
-    for (auto &system : update_systems) {
-      system->debug_log_pre();
-      system->before_first();
-      system->run_on(entities, dt);
-      system->debug_log_post();
-    }
+    // one tick per frame, whereChanged() & co compare against it
+    ComponentStorage::advance_tick();
+    query_stats::on_frame();
+    update_schedule.run(
+        [](System &system) {
+          system.debug_log_pre();
+          system.before_first();
+        },
+        [&](System &system) { system.run_on(entities, dt); },
+        [](System &system) {
+          system.debug_log_post();
+          // sync point
+          system.commands.apply();
+        });
   }
 
   void on_render(const Entities &entities, float dt) {
-    for (auto &system : render_systems) {
-      system->debug_log_pre();
-      system->before_first();
-      system->run_on(entities, dt);
-      system->debug_log_post();
-    }
+    render_schedule.run(
+        [](RenderSystem &system) {
+          system.debug_log_pre();
+          system.before_first();
+        },
+        [&](RenderSystem &system) { system.prepare(entities, dt); },
+        [](RenderSystem &system) {
+          system.debug_log_post();
+          system.commands.apply();
+        });
+    // draw order is list order, whatever order the prepares finished in
+    for (const RenderSystem *system : render_systems)
+      system->submit();
   }
 };
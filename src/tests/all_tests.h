@@ -0,0 +1,25 @@
+#pragma once
+
+#include "test_cached_query.h"
+#include "test_change_tracking.h"
+#include "test_command_buffer.h"
+#include "test_free_slot_index.h"
+#include "test_pathfinding.h"
+#include "test_pick.h"
+#include "test_spatial_grid.h"
+
+namespace tests {
+
+// Run with --tests, each test cleans up the entities it made
+inline void run_all() {
+  test_pick_stacked_cards();
+  test_pathfinding();
+  test_change_tracking();
+  test_cached_query();
+  test_spatial_grid();
+  test_command_buffer();
+  test_free_slot_index();
+  log_info("all tests passed");
+}
+
+} // namespace tests
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "../cached_query.h"
+#include "../components/is_draggable.h"
+#include "../components/is_slot.h"
+#include "../engine/assert.h"
+#include "../entity_helper.h"
+#include "../prefab.h"
+
+namespace tests {
+
+namespace internal {
+inline bool holds(const Entities &results, const Entity &entity) {
+  return std::find(results.begin(), results.end(), &entity) != results.end();
+}
+} // namespace internal
+
+// Entities gaining / losing a required component are picked up right away,
+// writes to what the filters read and pools that show up late force a
+// rebuild
+inline void test_cached_query() {
+  Prefab<Transform, IsSlot> slot{.type = EntityType::TraySlot};
+  std::vector<int> ids;
+  EntityHelper::spawn_n(slot, 3, [&](Entity &entity, size_t) {
+    ids.push_back(entity.id);
+  });
+  Entity &plain = EntityHelper::createEntity();
+  plain.addComponent<Transform>();
+
+  CachedQuery empty_slots(
+      StaticQuery<>().whereHasComponent<IsSlot>().whereLambda(
+          [](const Entity &entity) {
+            return entity.get<IsSlot>().is_empty();
+          }),
+      components::mask<IsSlot>());
+  M_TEST_EQ(empty_slots.size(), 3u, "initial build missed a slot");
+
+  plain.addComponent<IsSlot>();
+  M_TEST_EQ(empty_slots.size(), 4u, "added component was not picked up");
+  M_TEST_T(internal::holds(empty_slots.get(), plain),
+           "the new slot is not in the results");
+
+  Entity &first = EntityHelper::getEntityForID(ids[0]).asE();
+  first.removeComponent<IsSlot>();
+  M_TEST_EQ(empty_slots.size(), 3u, "removed component was not dropped");
+  M_TEST_F(internal::holds(empty_slots.get(), first),
+           "an entity without the component is still in the results");
+
+  // a write to a watched component makes the next get() rebuild
+  Entity &second = EntityHelper::getEntityForID(ids[1]).asE();
+  second.get_mut<IsSlot>().held_entity = plain.handle;
+  M_TEST_EQ(empty_slots.size(), 2u, "a filled slot still counts as empty");
+  second.get_mut<IsSlot>().held_entity = EntityHandle::null();
+  M_TEST_EQ(empty_slots.size(), 3u, "an emptied slot did not come back");
+
+  EntityHelper::markForCleanup(second);
+  EntityHelper::cleanup();
+  M_TEST_EQ(empty_slots.size(), 2u, "a destroyed entity is still there");
+
+  // a pool that registers after the query was made (static init order) is
+  // listened to from then on, and rows it already had are not missed
+  constexpr ComponentID draggable_id = components::get_type_id<IsDraggable>();
+  BaseComponentPool *const draggable_pool =
+      ComponentStorage::pools[draggable_id];
+  ComponentStorage::pools[draggable_id] = nullptr;
+  CachedQuery draggables(StaticQuery<>().whereHasComponent<IsDraggable>());
+  plain.addComponent<IsDraggable>();
+  ComponentStorage::pools[draggable_id] = draggable_pool;
+  M_TEST_EQ(draggables.size(), 1u, "rows of a late pool were missed");
+  Entity &third = EntityHelper::getEntityForID(ids[2]).asE();
+  third.addComponent<IsDraggable>();
+  M_TEST_EQ(draggables.size(), 2u, "a late pool is not listened to");
+  plain.removeComponent<IsDraggable>();
+  M_TEST_EQ(draggables.size(), 1u, "a late pool removal was missed");
+
+  EntityHelper::delete_all_entities(true);
+}
+
+} // namespace tests
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "../engine/assert.h"
+#include "../entity_helper.h"
+#include "../entity_query.h"
+#include "../prefab.h"
+
+namespace tests {
+
+// Only get_mut() counts as a change, reading through a non const entity
+// does not
+inline void test_change_tracking() {
+  Prefab<Transform> card{.type = EntityType::Card};
+  std::vector<int> ids;
+  EntityHelper::spawn_n(card, 4, [&](Entity &entity, size_t i) {
+    entity.get_mut<Transform>().init({100.f * i, 0}, {200, 80}, 0.f);
+    ids.push_back(entity.id);
+  });
+  ComponentStorage::advance_tick();
+
+  for (Entity *entity : EntityHelper::get_entities())
+    (void)entity->get<Transform>();
+  M_TEST_F(EntityQuery().whereChanged<Transform>().has_values(),
+           "a plain read counted as a change");
+
+  OptEntity moved = EntityHelper::getEntityForID(ids[2]);
+  moved->get_mut<Transform>().update({10, 10});
+  const RefEntities changed = EntityQuery().whereChanged<Transform>().gen();
+  M_TEST_EQ(changed.size(), 1u, "get_mut did not count as a change");
+  M_TEST_EQ(changed[0].get().id, ids[2], "the wrong entity changed");
+
+  // the next tick it is old news
+  ComponentStorage::advance_tick();
+  M_TEST_F(EntityQuery().whereChanged<Transform>().has_values(),
+           "a change from the last tick still matches");
+
+  EntityHelper::delete_all_entities(true);
+}
+
+} // namespace tests
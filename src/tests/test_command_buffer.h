@@ -0,0 +1,59 @@
+#pragma once
+
+#include "../command_buffer.h"
+#include "../components/is_slot.h"
+#include "../engine/assert.h"
+#include "../entity_helper.h"
+
+namespace tests {
+
+// Commands recorded while applying run in the same apply(), and a command
+// can call apply() again itself without losing or repeating anything
+inline void test_command_buffer() {
+  Entity &victim = EntityHelper::createEntity();
+  Entity &target = EntityHelper::createEntity();
+  const EntityHandle victim_handle = victim.handle;
+  const EntityHandle target_handle = target.handle;
+
+  CommandBuffer buffer;
+  int outer_runs = 0;
+  int inner_runs = 0;
+  int later_runs = 0;
+  EntityHandle inner;
+  buffer.create([&](Entity &entity) {
+    outer_runs++;
+    entity.addComponent<Transform>();
+    buffer.create([&](Entity &created) {
+      inner_runs++;
+      inner = created.handle;
+      // recorded from inside the nested apply, runs in its next batch
+      buffer.create([&](Entity &) { later_runs++; });
+    });
+    buffer.destroy(victim_handle);
+    buffer.apply();
+    M_TEST_T(buffer.empty(), "nested apply left commands behind");
+  });
+  // recorded before apply() started, still runs after the nested one
+  buffer.add<IsSlot>(target_handle);
+  buffer.apply();
+
+  M_TEST_T(buffer.empty(), "apply left commands behind");
+  M_TEST_EQ(outer_runs, 1, "outer create ran more than once");
+  M_TEST_EQ(inner_runs, 1, "nested create did not run exactly once");
+  M_TEST_EQ(later_runs, 1, "command recorded while nested did not run");
+  M_TEST_T(EntityHelper::getEntityForHandle(inner).valid(),
+           "nested create made no entity");
+  M_TEST_F(EntityHelper::getEntityForHandle(victim_handle).valid(),
+           "nested destroy did not happen");
+  OptEntity slot_owner = EntityHelper::getEntityForHandle(target_handle);
+  M_TEST_T(slot_owner.valid(), "target died");
+  M_TEST_T(slot_owner->has<IsSlot>(), "add recorded before apply was lost");
+
+  // nothing left over for a second apply to repeat
+  buffer.apply();
+  M_TEST_EQ(outer_runs, 1, "a second apply ran old commands again");
+
+  EntityHelper::delete_all_entities(true);
+}
+
+} // namespace tests
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+
+#include "../components/is_slot.h"
+#include "../engine/assert.h"
+#include "../entity_helper.h"
+#include "../free_slot_index.h"
+#include "../prefab.h"
+
+namespace tests {
+
+// Filling or emptying a slot through get_mut() shows up in nearest() after
+// the next sync(), wherever the slot moved in the meantime
+inline void test_free_slot_index() {
+  Prefab<Transform, IsSlot> slot{.type = EntityType::TraySlot};
+  const std::vector<float> xs = {0, 100, 300};
+  std::vector<Entity *> slots;
+  EntityHelper::spawn_n(slot, xs.size(), [&](Entity &entity, size_t i) {
+    entity.get_mut<Transform>().init({xs[i], 0}, {10, 10}, 0.f);
+    slots.push_back(&entity);
+  });
+  Entity &card = EntityHelper::createEntity();
+
+  FreeSlotIndex &index = FreeSlotIndex::get();
+  const auto nearest = [&](vec2 position, float range) -> Entity * {
+    index.sync();
+    OptEntity found = index.nearest(position, range);
+    return found ? found.value() : nullptr;
+  };
+  M_TEST_EQ(index.size(), 3u, "not every empty slot is indexed");
+  M_TEST_EQ(nearest({90, 0}, 1000), slots[1], "wrong nearest slot");
+
+  slots[1]->get_mut<IsSlot>().held_entity = card.handle;
+  M_TEST_EQ(nearest({90, 0}, 1000), slots[0], "a filled slot is still free");
+  M_TEST_EQ(nearest({90, 0}, 50), nullptr, "found a slot out of range");
+  M_TEST_EQ(index.size(), 2u, "filling a slot did not drop it");
+
+  slots[1]->get_mut<IsSlot>().held_entity = EntityHandle::null();
+  M_TEST_EQ(nearest({90, 0}, 1000), slots[1], "an emptied slot is missing");
+
+  // moved while full, it comes back where it is now
+  slots[2]->get_mut<IsSlot>().held_entity = card.handle;
+  index.sync();
+  slots[2]->get_mut<Transform>().update({95, 0});
+  index.sync();
+  M_TEST_EQ(nearest({95, 0}, 1000), slots[1], "a full slot was found");
+  slots[2]->get_mut<IsSlot>().held_entity = EntityHandle::null();
+  M_TEST_EQ(nearest({95, 0}, 1000), slots[2],
+            "an emptied slot came back where it used to be");
+
+  for (Entity *entity : slots)
+    entity->get_mut<IsSlot>().held_entity = card.handle;
+  M_TEST_EQ(nearest({95, 0}, 1000), nullptr, "found a slot with all full");
+  M_TEST_EQ(index.size(), 0u, "full slots are still counted");
+
+  EntityHelper::delete_all_entities(true);
+}
+
+} // namespace tests
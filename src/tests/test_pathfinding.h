@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "../components/is_solid.h"
+#include "../engine/assert.h"
+#include "../entity_helper.h"
+#include "../pathfinding.h"
+#include "../prefab.h"
+
+namespace tests {
+
+namespace internal {
+// One solid tile at tile (x, y)
+inline void make_wall(int x, int y) {
+  Prefab<Transform, IsSolid> wall;
+  Entity &entity = EntityHelper::spawn(wall);
+  entity.get_mut<Transform>().init(
+      {x * OccupancyGrid::TILE_SIZE, y * OccupancyGrid::TILE_SIZE},
+      {OccupancyGrid::TILE_SIZE, OccupancyGrid::TILE_SIZE}, 0.f);
+}
+
+inline vec2 center(int x, int y) { return OccupancyGrid::center_of({x, y}); }
+
+// Cost of walking `path` from `start`, -1 if a step is not to an open
+// neighbor
+inline float path_cost(vec2 start, const std::vector<vec2> &path) {
+  const OccupancyGrid &grid = OccupancyGrid::get();
+  OccupancyGrid::Tile at = OccupancyGrid::tile_of(start);
+  float cost = 0.f;
+  for (vec2 waypoint : path) {
+    const OccupancyGrid::Tile next = OccupancyGrid::tile_of(waypoint);
+    const int dx = std::abs(next.x - at.x);
+    const int dy = std::abs(next.y - at.y);
+    if (dx > 1 || dy > 1 || dx + dy == 0 || grid.is_blocked(next))
+      return -1.f;
+    cost += (dx && dy) ? 1.41421356f : 1.f;
+    at = next;
+  }
+  return cost;
+}
+} // namespace internal
+
+// A wall from y -4 to 4 at x 5, with a closed box around (20, 0)
+inline void test_pathfinding() {
+  using internal::center;
+  for (int y = -4; y <= 4; y++)
+    internal::make_wall(5, y);
+  for (int x = 19; x <= 21; x++) {
+    for (int y = -1; y <= 1; y++) {
+      if (x != 20 || y != 0)
+        internal::make_wall(x, y);
+    }
+  }
+
+  pathfinding::Pathfinder finder;
+  std::vector<vec2> path;
+  M_TEST_T(finder.find_path(center(0, 0), center(10, 0), path),
+           "no path around the wall");
+  M_TEST_T((OccupancyGrid::tile_of(path.back()) ==
+            OccupancyGrid::tile_of(center(10, 0))),
+           "path ends early");
+  // around the end of the wall at y 5 or -5, 8 diagonal steps and 4
+  // straight ones since the wall's corners cant be cut
+  const float cost = internal::path_cost(center(0, 0), path);
+  M_TEST_T((std::abs(cost - (4.f + 8.f * 1.41421356f)) < 0.01f),
+           "path is not the shortest or goes through a wall");
+
+  M_TEST_F(finder.find_path(center(0, 0), center(5, 0), path),
+           "found a path onto a wall");
+  M_TEST_F(finder.find_path(center(0, 0), center(20, 0), path),
+           "found a path into the closed box");
+  M_TEST_T(path.empty(), "failed search left waypoints");
+
+  pathfinding::FlowField field;
+  M_TEST_T(field.update(center(10, 0)), "field did not build");
+  M_TEST_F(field.update(center(10, 0)), "field rebuilt for nothing");
+
+  // wherever the field has a distance, A* agrees with it
+  for (int x = 0; x <= 24; x++) {
+    for (int y = -8; y <= 8; y++) {
+      const std::optional<float> distance = field.distance(center(x, y));
+      if (!distance || (x == 10 && y == 0))
+        continue;
+      M_TEST_T(finder.find_path(center(x, y), center(10, 0), path),
+               "field reaches a tile A* cant");
+      M_TEST_T((std::abs(*distance - internal::path_cost(center(x, y),
+                                                         path)) < 0.01f),
+               "field distance differs from A*");
+    }
+  }
+
+  // outside the field head straight for the goal, inside follow it
+  vec2 position = center(0, 0);
+  M_TEST_F(field.covers(position), "window is bigger than expected");
+  for (int i = 0; i < 100 && field.distance(position) != 0.f; i++) {
+    if (field.covers(position)) {
+      position = *field.next_step(position);
+      continue;
+    }
+    const vec2 goal = center(10, 0);
+    position = vec::lerp(position, goal,
+                         OccupancyGrid::TILE_SIZE /
+                             vec::distance(position, goal));
+  }
+  M_TEST_T((field.distance(position) == 0.f),
+           "following the field got stuck");
+
+  M_TEST_T(field.covers(center(20, 0)), "closed box is not covered");
+  M_TEST_F(field.next_step(center(20, 0)).has_value(),
+           "closed box has a way out");
+  M_TEST_F(field.covers(center(1000, 1000)), "far away is covered");
+  M_TEST_F(field.next_step(center(1000, 1000)).has_value(),
+           "step outside the covered area");
+
+  EntityHelper::delete_all_entities(true);
+  M_TEST_T(field.update(center(10, 0)), "field kept the removed walls");
+  M_TEST_T(field.covers(center(9, 0)), "field does not cover the goal");
+  M_TEST_T((std::abs(*field.distance(center(9, 0)) - 1.f) < 0.01f),
+           "open ground is not a straight line");
+}
+
+} // namespace tests
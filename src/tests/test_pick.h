@@ -0,0 +1,57 @@
+#pragma once
+
+#include "../aabb_tree.h"
+#include "../components/is_draggable.h"
+#include "../engine/assert.h"
+#include "../entity_helper.h"
+#include "../prefab.h"
+#include "../system/system.h"
+
+namespace tests {
+
+// Cards stacked on the same z, the one drawn last is the one on top
+inline void test_pick_stacked_cards() {
+  Prefab<Transform, RenderTags, IsDraggable> card{.type = EntityType::Card};
+  std::vector<int> ids;
+  EntityHelper::spawn_n(card, 8, [&](Entity &entity, size_t) {
+    entity.get_mut<Transform>().init({100, 100}, {200, 80}, 1.f);
+    ids.push_back(entity.id);
+  });
+
+  const auto draggable = [](const Entity &entity) {
+    return entity.has<IsDraggable>();
+  };
+  AABBTree &tree = AABBTree::get();
+  tree.sync();
+  OptEntity top = tree.pick({150, 120}, draggable);
+  M_TEST_T(top.has_value(), "nothing picked from the stack");
+  M_TEST_EQ(top->id, ids.back(), "picked a card under the top one");
+
+  // sorting keeps equal z in draw order and the pick follows it
+  PreRenderingSystem sort;
+  sort.run_on(EntityHelper::get_entities(), 0.f);
+  tree.sync();
+  top = tree.pick({150, 120}, draggable);
+  M_TEST_EQ(top->id, EntityHelper::get_entities().back()->id,
+            "pick does not match the render order after sorting");
+
+  // a higher z beats anything drawn later on a lower one
+  OptEntity bottom = EntityHelper::getEntityForID(ids.front());
+  bottom->get_mut<Transform>().z_index = 2.f;
+  tree.sync();
+  top = tree.pick({150, 120}, draggable);
+  M_TEST_EQ(top->id, ids.front(), "higher z lost to a lower card");
+
+  // the filter is only asked about cards that would win
+  top = tree.pick({150, 120}, [&](const Entity &entity) {
+    return entity.id != ids.front();
+  });
+  M_TEST_EQ(top->id, EntityHelper::get_entities().back()->id,
+            "filtered out card still picked");
+
+  M_TEST_F(tree.pick({0, 0}, draggable).has_value(), "picked empty space");
+
+  EntityHelper::delete_all_entities(true);
+}
+
+} // namespace tests
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+#include "../engine/assert.h"
+#include "../entity_helper.h"
+#include "../entity_query.h"
+#include "../prefab.h"
+#include "../spatial_grid.h"
+
+namespace tests {
+
+namespace internal {
+inline bool in_cells_around(vec2 position, const Entity &entity) {
+  bool found = false;
+  SpatialGrid::get().for_each_in(
+      {position - vec2{1, 1}, position + vec2{1, 1}},
+      [&](Entity &candidate) { found |= &candidate == &entity; });
+  return found;
+}
+} // namespace internal
+
+// A Transform written through get_mut() moves to its new cell on the next
+// sync(), queries sync on their own
+inline void test_spatial_grid() {
+  Prefab<Transform> card{.type = EntityType::Card};
+  EntityHelper::spawn_n(card, 20, [&](Entity &entity, size_t i) {
+    entity.get_mut<Transform>().init({40.f * i, 0}, {10, 10}, 0.f);
+  });
+  SpatialGrid &grid = SpatialGrid::get();
+  grid.sync();
+
+  Entity &moved = *EntityHelper::get_entities()[3];
+  const vec2 from = moved.get<Transform>().as2();
+  const vec2 to = {5000, -3000};
+  M_TEST_T(internal::in_cells_around(from, moved), "not bucketed at first");
+
+  moved.get_mut<Transform>().update(to);
+  grid.sync();
+  M_TEST_T(internal::in_cells_around(to, moved),
+           "not moved to its new cell after sync");
+  M_TEST_F(internal::in_cells_around(from, moved),
+           "still in its old cell after sync");
+
+  // moving inside the same cell keeps it there
+  moved.get_mut<Transform>().update(to + vec2{1, 1});
+  grid.sync();
+  M_TEST_T(internal::in_cells_around(to, moved),
+           "lost after moving inside its cell");
+
+  // no sync() by hand, the query does it
+  moved.get_mut<Transform>().update(from);
+  const RefEntities near = EntityQuery().whereInRange(from, 5.f).gen();
+  M_TEST_EQ(near.size(), 1u, "range query missed the moved entity");
+  M_TEST_EQ(&near[0].get(), &moved, "range query found the wrong entity");
+  M_TEST_T(EntityQuery().whereInRange(to, 5.f).gen().empty(),
+           "range query still finds it where it was");
+
+  EntityHelper::delete_all_entities(true);
+}
+
+} // namespace tests
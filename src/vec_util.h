@@ -1,5 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
 #include "vendor_include.h"
 
 #ifndef EPSILON
@@ -71,29 +76,27 @@ namespace vec {
 static constexpr int neigh_x[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
 static constexpr int neigh_y[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
 
-static void forEachNeighbor(int i, int j, std::function<void(const vec2 &)> cb,
-                            int step = 1) {
+// Takes any callable so there is no std::function (or allocation) per call
+template <typename Fn>
+static void forEachNeighbor(int i, int j, Fn &&cb, int step = 1) {
   for (int a = 0; a < 8; a++) {
     cb(vec2{(float)i + (neigh_x[a] * step), (float)j + (neigh_y[a] * step)});
   }
 }
 
-static std::vector<vec2> get_neighbors(int i, int j, int step = 1) {
-  std::vector<vec2> ns;
-  forEachNeighbor(
-      i, j, [&](const vec2 &v) { ns.push_back(v); }, step);
+static std::array<vec2, 8> get_neighbors(int i, int j, int step = 1) {
+  std::array<vec2, 8> ns;
+  for (int a = 0; a < 8; a++)
+    ns[a] = vec2{(float)i + (neigh_x[a] * step),
+                 (float)j + (neigh_y[a] * step)};
   return ns;
 }
 
-static std::vector<std::pair<int, int>> get_neighbors_i(int i, int j,
-                                                        int step = 1) {
-  std::vector<std::pair<int, int>> ns;
-  forEachNeighbor(
-      i, j,
-      [&](const vec2 &v) {
-        ns.push_back({(int)v.x, (int)v.y});
-      },
-      step);
+static std::array<std::pair<int, int>, 8> get_neighbors_i(int i, int j,
+                                                          int step = 1) {
+  std::array<std::pair<int, int>, 8> ns;
+  for (int a = 0; a < 8; a++)
+    ns[a] = {i + (neigh_x[a] * step), j + (neigh_y[a] * step)};
   return ns;
 }
 
@@ -107,8 +110,34 @@ float constexpr ce_sqrtf(float x) {
              : std::numeric_limits<float>::quiet_NaN();
 }
 
+constexpr float distance_sq(const vec2 a, const vec2 b) {
+  return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y);
+}
+
+// ce_sqrtf is only there so this still works in constant expressions, at
+// runtime the hardware sqrt is a single instruction
 constexpr float distance(const vec2 a, const vec2 b) {
-  return ce_sqrtf((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y));
+  if (std::is_constant_evaluated())
+    return ce_sqrtf(distance_sq(a, b));
+  return std::sqrt(distance_sq(a, b));
+}
+
+// Grid cell coordinates are clamped to this so far away or non finite
+// positions still get a cell, it fits an int and two of them fit one int64
+constexpr int64_t MAX_CELL = int64_t(1) << 30;
+
+// Turns an already floored / ceiled cell coordinate into an integer without
+// the UB of casting NaN, inf or something huge. NaN lands in cell 0
+inline int64_t clamp_cell(double cell) {
+  if (std::isnan(cell))
+    return 0;
+  return static_cast<int64_t>(std::clamp(cell, static_cast<double>(-MAX_CELL),
+                                         static_cast<double>(MAX_CELL)));
+}
+
+// The `cell_size` wide cell that `v` falls in
+inline int64_t cell_of(float v, float cell_size) {
+  return clamp_cell(std::floor(static_cast<double>(v) / cell_size));
 }
 
 inline float dot2(const vec2 &a, const vec2 &b) {
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "entity.h"
+
+// A View walks only the entities that have every component in Ts.
+// It picks the smallest pool to drive the iteration and probes the others,
+// so "all slots" costs O(#slots) no matter how many cards exist.
+//
+// Adding or removing any of Ts while iterating is not supported.
+template <typename... Ts> struct View {
+  static_assert(sizeof...(Ts) > 0, "A view needs at least one component");
+
+  const BaseComponentPool *driver = nullptr;
+
+  View() {
+    for (const BaseComponentPool *pool :
+         {static_cast<const BaseComponentPool *>(
+             &ComponentStorage::get<Ts>())...}) {
+      if (!driver || pool->size() < driver->size())
+        driver = pool;
+    }
+  }
+
+  [[nodiscard]] static bool matches(const Entity &entity) {
+    constexpr ComponentBitSet required = components::mask<Ts...>();
+    return (entity.componentSet & required) == required;
+  }
+
+  struct iterator {
+    using iterator_category = std::forward_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = Entity;
+    using pointer = Entity *;
+    using reference = Entity &;
+
+    const BaseComponentPool *pool = nullptr;
+    size_t index = 0;
+
+    iterator() {}
+    iterator(const BaseComponentPool *p, size_t i) : pool(p), index(i) {
+      skip();
+    }
+
+    reference operator*() const { return *pool->owners[index]; }
+    pointer operator->() const { return pool->owners[index]; }
+
+    iterator &operator++() {
+      index++;
+      skip();
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+
+    bool operator==(const iterator &other) const {
+      return index == other.index;
+    }
+
+  private:
+    void skip() {
+      while (index < pool->size() && !matches(*pool->owners[index]))
+        index++;
+    }
+  };
+
+  [[nodiscard]] iterator begin() const { return iterator(driver, 0); }
+  [[nodiscard]] iterator end() const {
+    return iterator(driver, driver->size());
+  }
+
+  // Calls fn(Entity&, Ts&...) for every matching entity.
+  // If fn takes every component by const & nothing is marked as changed,
+  // otherwise every visited row counts as written
+  template <typename Fn> void each(Fn &&fn) const {
+    for (Entity &entity : *this) {
+      const int slot = entity.handle.index;
+      if constexpr (std::is_invocable_v<Fn, Entity &, const Ts &...>) {
+        fn(entity, std::as_const(ComponentStorage::get<Ts>()).get(slot)...);
+      } else {
+        fn(entity, ComponentStorage::get<Ts>().get_mut(slot)...);
+      }
+    }
+  }
+
+  [[nodiscard]] size_t size_hint() const { return driver->size(); }
+};